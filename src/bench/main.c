@@ -0,0 +1,262 @@
+#include <gb.h>
+#include <profile.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+// M-cycles per second on real hardware
+#define GB_CYCLES_PER_SEC 1048576
+
+// M-cycles in one frame
+#define MCYCLES_PER_FRAME (TICKS_PER_FRAME / 4)
+
+// Columns of the results file, in order and separated by tabs (ROM names
+// have commas in them)
+#define RESULTS_HEADER "rom\tdispatch\tmcycles\tinstructions\truns\tmips\tmips_stddev\tfps\tfps_stddev\tns_per_mcycle\tns_per_mcycle_stddev"
+
+static const char *dispatch_names[] = {"blocks", "handlers", "table"};
+
+// Mean and standard deviation of a metric over the runs
+typedef struct {
+    double mean;
+    double stddev;
+} stat;
+
+typedef struct {
+    char rom[256];
+    char dispatch[16];
+    double mips;
+} baseline_entry;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static stat get_stat(const double *values, int n) {
+    stat s = {0, 0};
+
+    for (int i = 0; i < n; i++) {
+        s.mean += values[i];
+    }
+
+    s.mean /= n;
+
+    for (int i = 0; i < n; i++) {
+        s.stddev += (values[i] - s.mean) * (values[i] - s.mean);
+    }
+
+    s.stddev = n > 1 ? sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+// Puts the machine into its power-on state with the ROM loaded
+static bool reset(gb_t *gb, char *rom, cpu_dispatch dispatch) {
+    if (!cart_load(gb, rom)) {
+        return false;
+    }
+
+    ram_init(gb);
+    timer_init(gb);
+    cpu_init(gb);
+    cpu_set_dispatch(gb, dispatch);
+    gb->emu.ticks = 0;
+    return true;
+}
+
+// Counts the instructions the loaded ROM executes in the given number of
+// M-cycles. Runs one opcode per step, so idle loops count as if they had run.
+static u64 count_instructions(gb_t *gb, u64 cycles) {
+    u64 count = 0;
+
+    while (gb->emu.ticks / 4 < cycles) {
+        count += !gb->cpu.halted;
+        cpu_step(gb);
+    }
+
+    return count;
+}
+
+static const char *rom_name(const char *path) {
+    const char *name = strrchr(path, '/');
+
+    return name ? name + 1 : path;
+}
+
+// Reads the ROM, dispatch and MIPS columns of a results file
+static int load_baseline(const char *path, baseline_entry **entries) {
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int n = 0;
+
+    *entries = NULL;
+
+    if (!f) {
+        printf("Failed to open baseline: %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        baseline_entry e;
+
+        if (sscanf(line, "%255[^\t]\t%15[^\t]\t%*[^\t]\t%*[^\t]\t%*[^\t]\t%lf", e.rom, e.dispatch, &e.mips) != 3) {
+            continue;
+        }
+
+        *entries = realloc(*entries, (n + 1) * sizeof(baseline_entry));
+        (*entries)[n++] = e;
+    }
+
+    fclose(f);
+    return n;
+}
+
+static void usage() {
+    printf("Usage: gbbench [-r runs] [-o results.tsv] [-b baseline.tsv] [-t max_regression_percent]\n");
+    printf("               <blocks|handlers|table> <emulated_seconds> <rom_file>...\n");
+}
+
+int main(int argc, char **argv) {
+    int runs = 5;
+    const char *out = NULL;
+    const char *baseline = NULL;
+    double threshold = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:o:b:t:")) != -1) {
+        switch (opt) {
+            case 'r': runs = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'b': baseline = optarg; break;
+            case 't': threshold = atof(optarg); break;
+
+            default:
+                usage();
+                return -1;
+        }
+    }
+
+    if (argc - optind < 3 || runs < 1) {
+        usage();
+        return -1;
+    }
+
+    cpu_dispatch dispatch = DISPATCH_BLOCKS;
+
+    if (!strcmp(argv[optind], "handlers")) {
+        dispatch = DISPATCH_HANDLERS;
+    } else if (!strcmp(argv[optind], "table")) {
+        dispatch = DISPATCH_TABLE;
+    }
+
+    u64 cycles = atof(argv[optind + 1]) * GB_CYCLES_PER_SEC;
+    double frames = (double)cycles / MCYCLES_PER_FRAME;
+    double total = 0;
+    int regressions = 0;
+
+    baseline_entry *base = NULL;
+    int num_base = 0;
+
+    if (baseline && (num_base = load_baseline(baseline, &base)) < 0) {
+        return -3;
+    }
+
+    FILE *tsv = NULL;
+
+    if (out && !(tsv = fopen(out, "w"))) {
+        printf("Failed to create %s\n", out);
+        return -3;
+    }
+
+    if (tsv) {
+        fprintf(tsv, RESULTS_HEADER "\n");
+    }
+
+    // One instance for all the ROMs, so the IO counts add up like the opcode counts
+    gb_t *gb = gb_create();
+    double *mips = calloc(runs, sizeof(double));
+    double *fps = calloc(runs, sizeof(double));
+    double *ns = calloc(runs, sizeof(double));
+
+    for (int i = optind + 2; i < argc; i++) {
+        if (!reset(gb, argv[i], DISPATCH_HANDLERS)) {
+            printf("Failed to load ROM file: %s\n", argv[i]);
+            gb_destroy(gb);
+            return -2;
+        }
+
+        u64 instrs = count_instructions(gb, cycles);
+
+        for (int r = 0; r < runs; r++) {
+            reset(gb, argv[i], dispatch);
+
+            double start = now();
+
+            while (gb->emu.ticks / 4 < cycles) {
+                cpu_step(gb);
+            }
+
+            double elapsed = now() - start;
+
+            mips[r] = instrs / elapsed / 1e6;
+            fps[r] = frames / elapsed;
+            ns[r] = elapsed * 1e9 / cycles;
+            total += elapsed / runs;
+        }
+
+        stat s_mips = get_stat(mips, runs);
+        stat s_fps = get_stat(fps, runs);
+        stat s_ns = get_stat(ns, runs);
+
+        printf("BENCH %s: %.2f MIPS (+-%.2f), %.0f fps (+-%.0f), %.2f ns per M-cycle (+-%.2f), %.1fx real time\n",
+            argv[i], s_mips.mean, s_mips.stddev, s_fps.mean, s_fps.stddev, s_ns.mean, s_ns.stddev,
+            1e9 / s_ns.mean / GB_CYCLES_PER_SEC);
+
+        if (tsv) {
+            fprintf(tsv, "%s\t%s\t%lu\t%lu\t%d\t%.4f\t%.4f\t%.2f\t%.2f\t%.4f\t%.4f\n", rom_name(argv[i]),
+                dispatch_names[dispatch], (unsigned long)cycles, (unsigned long)instrs, runs,
+                s_mips.mean, s_mips.stddev, s_fps.mean, s_fps.stddev, s_ns.mean, s_ns.stddev);
+        }
+
+        // Compare with the same ROM and dispatch in the baseline
+        for (int b = 0; b < num_base; b++) {
+            if (strcmp(base[b].rom, rom_name(argv[i])) || strcmp(base[b].dispatch, dispatch_names[dispatch])) {
+                continue;
+            }
+
+            double change = (s_mips.mean / base[b].mips - 1) * 100;
+
+            if (change < -threshold) {
+                printf("REGRESSION %s: %.2f MIPS, baseline %.2f (%.1f%%)\n", argv[i], s_mips.mean,
+                    base[b].mips, change);
+                regressions++;
+            } else {
+                printf("BASELINE %s: %+.1f%%\n", argv[i], change);
+            }
+        }
+    }
+
+    printf("BENCH total: %.3f s\n", total);
+
+    if (tsv) {
+        fclose(tsv);
+    }
+
+    // Opcode sequence counts across all the ROMs (GBEMU_PROFILE builds only)
+    profile_report(gb, 20);
+
+    gb_destroy(gb);
+    free(mips);
+    free(fps);
+    free(ns);
+    free(base);
+
+    if (regressions) {
+        printf("%d ROMs regressed by more than %.0f%%\n", regressions, threshold);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,5 +1,91 @@
-#include <emu.h>
+#include <stdio.h>
+#include <gb.h>
+#include <ui.h>
+
+//TODO Add Windows Alternative...
+#include <pthread.h>
+#include <unistd.h>
+
+/* 
+  Emu components:
+
+  |Cart|
+  |CPU|
+  |Address Bus|
+  |PPU|
+  |Timer|
+
+*/
+
+// Main CPU thread
+static void *cpu_run(void *p) {
+    gb_t *gb = p;
+    emu_context *ctx = &gb->emu;
+
+    ctx->running = true;
+    ctx->paused = false;
+    ctx->ticks = 0;
+
+    while(ctx->running) {
+        if (ctx->paused) {
+            delay(10);
+            continue;
+        }
+
+        if (!cpu_step(gb)) {
+            printf("CPU Stopped\n");
+            return 0;
+        }
+    }
+
+    return 0;
+}
 
 int main(int argc, char **argv) {
-    return emu_run(argc, argv);
+    if (argc < 2) {
+        printf("Usage: emu <rom_file>\n");
+        return -1;
+    }
+
+    gb_t *gb = gb_create();
+
+    if (!gb) {
+        fprintf(stderr, "Failed to allocate the emulator\n");
+        return -1;
+    }
+
+    // The cartridge clock keeps wall clock time while the game is played
+    rtc_set_realtime(gb, true);
+
+    if (!cart_load(gb, argv[1])) {
+        printf("Failed to load ROM file: %s\n", argv[1]);
+        return -2;
+    }
+
+    printf("Cart loaded..\n");
+
+    // Use code compiled by gbrecomp for this ROM if there is any
+    char *aot_dir = getenv("GBEMU_AOT_DIR");
+    aot_load(gb, aot_dir ? aot_dir : "aot");
+
+    // Idle loops the detector misses can be listed per ROM
+    char *idle_file = getenv("GBEMU_IDLE_FILE");
+    idle_load(gb, idle_file ? idle_file : "idle_loops.txt");
+
+    ui_init();
+    
+    pthread_t t1;
+    
+    // Start the main CPU thread
+    if (pthread_create(&t1, NULL, cpu_run, gb)) {
+        fprintf(stderr, "FAILED TO START MAIN CPU THREAD!\n");
+        return -1;
+    }
+
+    while(!gb->emu.die) {
+        usleep(1000);
+        ui_handle_events(gb);
+    }
+
+    return 0;
 }
@@ -1,5 +1,5 @@
 #include <ui.h>
-#include <emu.h>
+#include <gb.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
@@ -22,7 +22,7 @@ void delay(u32 ms) {
     SDL_Delay(ms);
 }
 
-void ui_handle_events() {
+void ui_handle_events(gb_t *gb) {
     SDL_Event e;
     while (SDL_PollEvent(&e) > 0)
     {
@@ -31,7 +31,7 @@ void ui_handle_events() {
         //TODO SDL_UpdateWindowSurface(sdlDebugWindow);
 
         if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_CLOSE) {
-            emu_get_context()->die = true;
+            gb->emu.die = true;
         }
     }
 }
\ No newline at end of file
@@ -6,4 +6,8 @@ static const int SCREEN_WIDTH = 1024;
 static const int SCREEN_HEIGHT = 768;
 
 void ui_init();
-void ui_handle_events();
\ No newline at end of file
+
+// Sleeps for the given number of milliseconds
+void delay(u32 ms);
+
+void ui_handle_events(gb_t *gb);
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include <gb.h>
+#include <sys/stat.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: gbrecomp <rom_file> [output_dir]\n");
+        return -1;
+    }
+
+    gb_t *gb = gb_create();
+
+    if (!cart_load(gb, argv[1])) {
+        printf("Failed to load ROM file: %s\n", argv[1]);
+        gb_destroy(gb);
+        return -2;
+    }
+
+    // The emulator looks in ./aot unless GBEMU_AOT_DIR says otherwise
+    char *dir = argc > 2 ? argv[2] : "aot";
+    mkdir(dir, 0755);
+
+    bool ok = aot_compile(gb, dir);
+
+    gb_destroy(gb);
+    return ok ? 0 : -3;
+}
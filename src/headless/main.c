@@ -0,0 +1,97 @@
+#include <gb.h>
+#include <string.h>
+#include <unistd.h>
+
+// Serial output texts that end the run
+#define MAX_STOP_TEXTS 8
+
+static void usage() {
+    printf("Usage: gbemu-headless [-f frames] [-s text]... <rom_file>\n");
+    printf("  -f frames  Stop after this many frames (default 3600)\n");
+    printf("  -s text    Stop as soon as the serial output contains text\n");
+}
+
+// Returns the first stop text found in the serial output, or NULL
+static const char *stop_text(gb_t *gb, char **texts, int num_texts) {
+    for (int i = 0; i < num_texts; i++) {
+        if (strstr(gb->debug.msg, texts[i])) {
+            return texts[i];
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    long frames = 3600;
+    char *texts[MAX_STOP_TEXTS];
+    int num_texts = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:")) != -1) {
+        switch (opt) {
+            case 'f':
+                frames = atol(optarg);
+                break;
+
+            case 's':
+                if (num_texts == MAX_STOP_TEXTS) {
+                    printf("At most %d stop texts\n", MAX_STOP_TEXTS);
+                    return -1;
+                }
+
+                texts[num_texts++] = optarg;
+                break;
+
+            default:
+                usage();
+                return -1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        return -1;
+    }
+
+    gb_t *gb = gb_create();
+
+    if (!gb) {
+        fprintf(stderr, "Failed to allocate the emulator\n");
+        return -1;
+    }
+
+    if (!cart_load(gb, argv[optind])) {
+        printf("Failed to load ROM file: %s\n", argv[optind]);
+        gb_destroy(gb);
+        return -2;
+    }
+
+    // Same code and idle loop lists as the SDL frontend
+    char *aot_dir = getenv("GBEMU_AOT_DIR");
+    aot_load(gb, aot_dir ? aot_dir : "aot");
+
+    char *idle_file = getenv("GBEMU_IDLE_FILE");
+    idle_load(gb, idle_file ? idle_file : "idle_loops.txt");
+
+    // The serial output is printed once at the end
+    gb->debug.quiet = true;
+
+    const char *stop = NULL;
+    long frame = 0;
+
+    while (frame < frames && !stop) {
+        emu_run_frame(gb);
+        frame++;
+        stop = stop_text(gb, texts, num_texts);
+    }
+
+    printf("Serial: %s\n", gb->debug.msg);
+    printf("Frames: %ld, M-cycles: %lu, stopped by: %s\n", frame,
+        (unsigned long)(gb->emu.ticks / 4), stop ? stop : "frame limit");
+
+    gb_destroy(gb);
+
+    // Running out of frames only fails when waiting for a text
+    return num_texts && !stop ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common.h>
+
+// Precomputed 8-bit ALU results
+// Every entry holds the result in the low byte and the F register in the high
+// byte, so an operation and its flags take a single load. The tables are
+// filled in by alu_init().
+
+#define ALU_RESULT(e) ((u8)((e) & 0xFF))
+#define ALU_FLAGS(e) ((u8)((e) >> 8))
+
+// CB rotate/shift operations, in opcode order
+typedef enum {
+    ALU_RLC,
+    ALU_RRC,
+    ALU_RL,
+    ALU_RR,
+    ALU_SLA,
+    ALU_SRA,
+    ALU_SWAP,
+    ALU_SRL
+} alu_shift_op;
+
+// ADD/ADC: [carry][a][b]
+extern u16 alu_add_table[2][256][256];
+
+// SUB/SBC/CP: [carry][a][b]
+extern u16 alu_sub_table[2][256][256];
+
+// INC/DEC: [value], the C bit is always clear (INC/DEC keep the old carry)
+extern u16 alu_inc_table[256];
+extern u16 alu_dec_table[256];
+
+// DAA: [N << 2 | H << 1 | C][a]
+extern u16 alu_daa_table[8][256];
+
+// RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL: [op][carry][value]
+extern u16 alu_shift_table[8][2][256];
+
+// Builds the tables
+void alu_init();
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <common.h>
+#include <block.h>
+
+// Ahead-of-time recompiler
+// aot_compile() disassembles the cartridge by recursive traversal from the
+// entry point and interrupt vectors, writes C for every block it reaches and
+// builds it into <sha1 of the ROM>.so. Once aot_load() has loaded the shared
+// object, the block cache runs those blocks natively. Code the static pass
+// missed (jump tables, RAM code, other ROM banks) stays in the interpreter.
+
+// Bumped whenever the interface between the emulator and compiled code
+// (including the cpu_context and gb_t layouts) changes
+#define AOT_VERSION 8
+
+// Emulator functions the compiled code calls
+typedef struct {
+    void (*emu_cycles)(gb_t *gb, int cpu_cycles);
+    void (*debug_update)(gb_t *gb);
+    void (*debug_print)(gb_t *gb);
+    void (*trace_step)(cpu_context *ctx, u16 pc, u8 opcode, u16 operands); // NULL unless tracing
+    void (*handle_interrupts)(cpu_context *ctx);
+    const OP_HANDLER *op_handlers;
+} aot_runtime;
+
+// A compiled block
+typedef struct {
+    u16 bank;
+    u16 pc;
+    BLOCK_NATIVE fn;
+} aot_block;
+
+// Shared object loaded by an instance. Instances running the same ROM share
+// one mapping of it, the code keeps no state of its own.
+typedef struct {
+    void *handle;
+    const aot_block *blocks;
+    u32 num_blocks;
+} aot_context;
+
+// Writes <dir>/<sha1>.c for the current cartridge and builds <dir>/<sha1>.so
+bool aot_compile(gb_t *gb, const char *dir);
+
+// Loads <dir>/<sha1>.so for the current cartridge if it exists
+bool aot_load(gb_t *gb, const char *dir);
+
+// Unloads the compiled code
+void aot_unload(gb_t *gb);
+
+// Returns the compiled block starting at (bank, pc), or NULL
+BLOCK_NATIVE aot_lookup(gb_t *gb, u16 bank, u16 pc);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <common.h>
+#include <cpu.h>
+
+// Pre-decoded basic block cache
+// Straight-line code is decoded once into a list of opcode handlers and kept
+// in a per instance cache keyed by (ROM bank, PC). Common opcode sequences get a single
+// fused handler (fused_ops). Blocks in WRAM/HRAM are dropped as soon
+// as the memory they were decoded from is written.
+
+// Maximum number of instructions in a block
+#define BLOCK_MAX_INSTRS 32
+
+// Number of blocks in the cache (must be a power of 2)
+#define BLOCK_CACHE_SIZE 4096
+
+// A pre-decoded instruction
+typedef struct {
+    OP_HANDLER handler; // Specialized handler for the opcode
+    u16 next_pc;        // Address of the following instruction
+    u8 opcode;          // Opcode
+    u8 fused;           // Number of following instructions the handler also runs
+} block_instr;
+
+// Native code for a block, produced by the JIT
+typedef void (*BLOCK_NATIVE)(cpu_context *ctx);
+
+// A decoded basic block
+typedef struct {
+    u16 pc;     // Address of the first instruction
+    u16 bank;   // ROM bank the block was decoded from (0 for RAM)
+    u32 gen;    // Code generation when decoded (RAM blocks only)
+    u8 count;   // Number of instructions (0 if the slot is empty)
+    bool ram;   // True if the block lives in WRAM/HRAM
+    u8 idle;    // Idle loop flags (see idle.h)
+    u64 runs;   // Number of times the block was entered
+    u64 cycles; // M-cycles spent in the block
+    BLOCK_NATIVE native; // AOT or JIT code (NULL if the block is interpreted)
+    block_instr instrs[BLOCK_MAX_INSTRS];
+} code_block;
+
+typedef struct {
+    code_block blocks[BLOCK_CACHE_SIZE];
+
+    // Incremented whenever cached code may have changed (RAM code writes or
+    // bank switches)
+    u32 gen;
+
+    // One flag per 16 bytes of 0xC000 - 0xFFFF, set if a block was decoded there
+    u8 code_lines[0x400];
+} block_cache;
+
+// Returns the block starting at pc, decoding it if needed.
+// Returns NULL if the code at pc cannot be cached.
+code_block *block_lookup(gb_t *gb, u16 pc);
+
+// Checks if the instruction ends a basic block
+bool block_ends(instruction *instr);
+
+// Returns the end (exclusive) of the cacheable region containing pc, or 0
+u32 block_region_end(u16 pc);
+
+// Drops every cached block
+void block_flush(gb_t *gb);
+
+// Drops the JIT code of every cached block
+void block_drop_native(gb_t *gb);
+
+// Invalidates RAM blocks if address holds cached code
+void block_ram_written(gb_t *gb);
+
+// block_ram_write, which every write to WRAM/HRAM must call, is inline in gb.h
@@ -2,14 +2,45 @@
 
 #include <common.h>
 
-// Reads a byte from the bus at the given address
-u8 bus_read(u16 address);
+// Page table
+// One entry per 256-byte page of the address space. Pages backed by plain
+// memory (ROM banks, WRAM) point straight at it and are read or written
+// without a handler. NULL pages go through bus_read_slow/bus_write_slow:
+// IO, HRAM and IE, cartridge control writes, and anything that has to see
+// the access (e.g. WRAM pages holding cached code). Bank switches and
+// lockouts update the entries instead of adding checks to the fast path.
 
-// Writes a byte to the bus at the given address
-void bus_write(u16 address, u8 value);
+typedef struct {
+    // Host memory for each page, NULL if reads need a handler
+    u8 *read_pages[0x100];
+
+    // Host memory for each page, NULL if writes need a handler
+    u8 *write_pages[0x100];
+
+    // Write mappings, including pages currently protected
+    u8 *mapped_write_pages[0x100];
+} bus_context;
+
+// Maps whole pages from start to host memory (NULL unmaps)
+void bus_map(gb_t *gb, u16 start, u32 size, u8 *read, u8 *write);
+
+// Sends writes to the page holding address through the handlers until
+// bus_unprotect_writes
+void bus_protect_write(gb_t *gb, u16 address);
+
+// Restores the mapped write pages
+void bus_unprotect_writes(gb_t *gb);
+
+// Reads a byte through the handlers
+u8 bus_read_slow(gb_t *gb, u16 address);
+
+// Writes a byte through the handlers
+void bus_write_slow(gb_t *gb, u16 address, u8 value);
+
+// bus_read and bus_write go through the page table inline, see gb.h
 
 // Reads a 16-bit value from the bus at the given address
-u16 bus_read16(u16 address);
+u16 bus_read16(gb_t *gb, u16 address);
 
 // Writes a 16-bit value to the bus at the given address
-void bus_write16(u16 address, u16 value);
\ No newline at end of file
+void bus_write16(gb_t *gb, u16 address, u16 value);
@@ -21,11 +21,70 @@ typedef struct {
     u16 global_checksum;
 } rom_header;
 
+// Memory bank controllers
+typedef enum {
+    MBC_NONE,
+    MBC_1,
+    MBC_2,
+    MBC_3,
+    MBC_5
+} cart_mbc;
+
+// Cartridge context
+typedef struct {
+    char filename[1024]; // Filename of the cartridge
+    u32 rom_size;        // Size of the ROM
+    u8 *rom_data;        // Pointer to the ROM data (read-only)
+    u32 rom_mapped;      // Length of the file mapping, 0 if rom_data is a heap copy
+    const rom_header *header; // Pointer to cartridge header
+
+    cart_mbc mbc;
+    u32 rom_banks;       // Number of 16KB ROM banks
+    u8 *ram_data;        // External RAM (MBC2 built-in RAM), NULL if none
+    u32 ram_size;        // Size of the external RAM
+    u32 ram_mask;        // Offset mask within a RAM bank (smaller for 2KB RAM)
+    bool rtc;            // MBC3 with a real-time clock
+
+    // Save file mapping: battery RAM, then the clock state
+    u8 *save;            // NULL if ram_data is a heap copy
+    u32 save_size;
+    bool ram_dirty;      // RAM has been enabled, so written, since the last flush
+
+    // MBC registers
+    bool ram_enabled;
+    u16 rom_bank;        // ROM bank number (MBC1: low 5 bits)
+    u8 bank2;            // MBC1 upper bits, MBC3/MBC5 RAM bank (MBC3 RTC select)
+    bool mode;           // MBC1 banking mode
+
+    // Current mapping, recomputed on every MBC register write
+    u16 bank_lo;         // ROM bank at 0x0000 - 0x3FFF
+    u16 bank_hi;         // ROM bank at 0x4000 - 0x7FFF
+    u8 *rom_lo;
+    u8 *rom_hi;
+    u8 *ram;             // RAM bank at 0xA000 - 0xBFFF, NULL if disabled or absent
+} cart_context;
+
 // True if the cartridge is loaded successfully
-bool cart_load(char *cart);
+bool cart_load(gb_t *gb, char *cart);
+
+// Flushes the save file and releases the ROM and RAM
+void cart_unload(gb_t *gb);
 
 // Reads a byte from the cartridge at the given address
-u8 cart_read(u16 address);
+u8 cart_read(gb_t *gb, u16 address);
 
 // Writes a byte to the cartridge at the given address
-void cart_write(u16 address, u8 value);
\ No newline at end of file
+void cart_write(gb_t *gb, u16 address, u8 value);
+
+// Returns the ROM bank currently mapped at 0x4000 - 0x7FFF
+u16 cart_rom_bank(gb_t *gb);
+
+// Returns the ROM bank currently mapped at 0x0000 - 0x3FFF (0 unless an MBC1
+// in mode 1 maps another one there)
+u16 cart_rom_bank0(gb_t *gb);
+
+// Returns the raw ROM image (read-only, possibly a file mapping)
+const u8 *cart_rom_data(gb_t *gb);
+
+// Returns the size of the ROM image in bytes
+u32 cart_rom_size(gb_t *gb);
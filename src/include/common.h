@@ -10,6 +10,9 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
+// An emulated Game Boy, owning all of its state (see gb.h)
+typedef struct gb gb_t;
+
 // BIT(a, n) - Get the nth bit of a
 #define BIT(a, n) ((a & (1 << n)) ? 1 : 0)
 
@@ -19,7 +22,5 @@ typedef uint64_t u64;
 // BETWEEN(a, b, c) - Check if a is between b and c
 #define BETWEEN(a, b, c) ((a >= b) && (a <= c))
 
-void delay(u32 ms);
-
 // Used to mark functions that are not yet implemented
 #define NO_IMPL { fprintf(stderr, "NOT YET IMPLEMENTED\n"); exit(-5); }
\ No newline at end of file
@@ -3,50 +3,94 @@
 #include <common.h>
 #include <instructions.h>
 
+// A register pair overlaid with its two halves, high register in the high byte
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CPU_REG_PAIR(hi, lo) union { u16 hi##lo; struct { u8 hi; u8 lo; }; }
+#else
+#define CPU_REG_PAIR(hi, lo) union { u16 hi##lo; struct { u8 lo; u8 hi; }; }
+#endif
+
 // Defines the Gameboy CPU (LR35902) registers
-typedef struct {
-    u8 a;
-    u8 f;
-    u8 b;
-    u8 c;
-    u8 d;
-    u8 e;
-    u8 h;
-    u8 l;
-    u16 sp;
-    u16 pc;
+// 8-bit registers and pairs alias each other, e.g. regs.bc == (regs.b << 8) | regs.c
+typedef union {
+    struct {
+        CPU_REG_PAIR(a, f);
+        CPU_REG_PAIR(b, c);
+        CPU_REG_PAIR(d, e);
+        CPU_REG_PAIR(h, l);
+        u16 sp;
+        u16 pc;
+    };
+
+    // AF, BC, DE, HL, SP, PC indexed by reg_type - RT_AF
+    u16 r16[6];
+
+    // Indexed by cpu_reg8_index[reg_type]
+    u8 r8[12];
 } cpu_registers;
 
+// Index into cpu_registers.r8 for RT_A - RT_L
+extern const u8 cpu_reg8_index[RT_L + 1];
+
+// Instruction dispatch engines
+typedef enum {
+    DISPATCH_BLOCKS,   // Pre-decoded blocks of op_handlers (block cache)
+    DISPATCH_HANDLERS, // One specialized handler per opcode (op_handlers)
+    DISPATCH_TABLE     // instructions[] + fetch_data() + processors[]
+} cpu_dispatch;
+
+// Lazily evaluated flags
+// ALU operations record the operation, operands and result instead of
+// computing F. F is only computed when something reads it (cpu_get_f).
+typedef enum {
+    LF_NONE,  // regs.f is up to date
+    LF_ADD,   // ADD/ADC: lf_res = lf_a + lf_b (+ carry)
+    LF_SUB,   // SUB/SBC/CP: lf_res = lf_a - lf_b (- carry)
+    LF_AND,   // AND: Z010
+    LF_LOGIC, // XOR/OR: Z000
+    LF_INC,   // INC r: lf_res = r + 1, old carry in lf_b
+    LF_DEC    // DEC r: lf_res = r - 1, old carry in lf_b
+} lazy_flags;
 
 typedef struct {
+    // Hot state, touched by every instruction; keep it within one cache line
     cpu_registers regs;
 
+    // Last flag-producing operation (see lazy_flags)
+    u8 lf_op;
+    u8 lf_a;
+    u8 lf_b;
+    u16 lf_res;
+
+    bool interrupt_master_enabled;
+    bool enabling_ime;
+    bool halted;
+    u8 ie_register;
+    u8 int_flags;
+    u8 int_pending; // int_flags & ie_register, see cpu_update_int_pending
+
     // Current fetched data in the FDE cycle
     u16 fetched_data;
     u16 mem_dest;
     bool dest_is_mem;
     u8 curr_opcode;
-    instruction *curr_instr;
-
-    bool halted;
-    bool stepping;
 
-    bool interrupt_master_enabled;
-    bool enabling_ime;
-    u8 ie_register;
-    u8 int_flags;
+    cpu_dispatch dispatch;
 
+    // Cold state, only used by the table path and the debugger
+    instruction *curr_instr;
+    bool stepping;
 } cpu_context;
 
 // Gets the registers
-cpu_registers *cpu_get_regs();
+cpu_registers *cpu_get_regs(gb_t *gb);
 
 // Initializes the CPU
-void cpu_init();
+void cpu_init(gb_t *gb);
 
 // Steps the CPU by one cycle
 // Returns true if the CPU is still running
-bool cpu_step();
+bool cpu_step(gb_t *gb);
 
 // A function pointer to a function that processes an instruction
 typedef void (*IN_PROC)(cpu_context *ctx);
@@ -54,41 +98,111 @@ typedef void (*IN_PROC)(cpu_context *ctx);
 // Returns the processor for a given instruction type
 IN_PROC inst_get_processor(in_type type);
 
+// Reads the operands of curr_instr at pc into fetched_data / mem_dest
+void fetch_data(cpu_context *ctx);
+
+// A specialized handler that executes one opcode
+typedef void (*OP_HANDLER)(cpu_context *ctx);
+
+// Specialized handlers for every opcode, CB-prefixed opcodes at 0x100 - 0x1FF
+extern const OP_HANDLER op_handlers[0x200];
+
+// A superinstruction: one handler that runs a common opcode sequence
+typedef struct {
+    u8 opcodes[3]; // Opcodes in execution order
+    u8 count;      // Number of opcodes in the sequence
+    OP_HANDLER handler;
+} fused_op;
+
+// Superinstructions the block decoder substitutes, longest first
+extern const fused_op fused_ops[];
+extern const int fused_op_count;
+
+// Selects the instruction dispatch engine used by cpu_step
+void cpu_set_dispatch(gb_t *gb, cpu_dispatch dispatch);
+
+// Computes regs.f from the last flag-producing operation and returns it
+u8 cpu_eval_flags(cpu_context *ctx);
+
+// Returns the F register
+static inline u8 cpu_get_f(cpu_context *ctx) {
+    return ctx->lf_op == LF_NONE ? ctx->regs.f : cpu_eval_flags(ctx);
+}
+
+// Sets the F register
+static inline void cpu_set_f(cpu_context *ctx, u8 f) {
+    ctx->regs.f = f;
+    ctx->lf_op = LF_NONE;
+}
+
+// Sets the Z, N, H and C flags, -1 leaves a flag unchanged
+void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c);
+
+// Records a flag-producing operation instead of computing F
+static inline void cpu_lazy_flags(cpu_context *ctx, lazy_flags op, u8 a, u8 b, u16 res) {
+    ctx->lf_op = op;
+    ctx->lf_a = a;
+    ctx->lf_b = b;
+    ctx->lf_res = res;
+}
+
+// Recomputes the interrupts both requested and enabled. Must be called
+// whenever int_flags or ie_register change.
+static inline void cpu_update_int_pending(cpu_context *ctx) {
+    ctx->int_pending = ctx->int_flags & ctx->ie_register & 0x1F;
+}
+
+// Z and C are read by every conditional branch, so they skip the full evaluation
+static inline u8 cpu_flag_z(cpu_context *ctx) {
+    return ctx->lf_op == LF_NONE ? BIT(ctx->regs.f, 7) : (ctx->lf_res & 0xFF) == 0;
+}
+
+static inline u8 cpu_flag_c(cpu_context *ctx) {
+    switch (ctx->lf_op) {
+        case LF_NONE: return BIT(ctx->regs.f, 4);
+        case LF_ADD:
+        case LF_SUB: return (ctx->lf_res >> 8) & 1;
+        case LF_INC:
+        case LF_DEC: return ctx->lf_b;
+        default: return 0;
+    }
+}
+
 // Z Flag: Zero Flag
-#define CPU_FLAG_Z BIT(ctx->regs.f, 7)
+#define CPU_FLAG_Z cpu_flag_z(ctx)
 
 // N Flag: Subtract Flag
-#define CPU_FLAG_N BIT(ctx->regs.f, 6)
+#define CPU_FLAG_N BIT(cpu_get_f(ctx), 6)
 
 // H Flag: Half Carry Flag
-#define CPU_FLAG_H BIT(ctx->regs.f, 5)
+#define CPU_FLAG_H BIT(cpu_get_f(ctx), 5)
 
 // C Flag: Carry Flag
-#define CPU_FLAG_C BIT(ctx->regs.f, 4)
+#define CPU_FLAG_C cpu_flag_c(ctx)
 
 // Returns the value of the given register
-u16 cpu_read_reg(reg_type rt);
+u16 cpu_read_reg(cpu_context *ctx, reg_type rt);
 
 // Sets the value of the given register
-void cpu_set_reg(reg_type rt, u16 val);
+void cpu_set_reg(cpu_context *ctx, reg_type rt, u16 val);
 
 // Returns the value of the given 8-bit register
-u8 cpu_read_reg8(reg_type rt);
+u8 cpu_read_reg8(cpu_context *ctx, reg_type rt);
 
 // Sets the value of the given 8-bit register
-void cpu_set_reg8(reg_type rt, u8 val);
+void cpu_set_reg8(cpu_context *ctx, reg_type rt, u8 val);
 
 // Gets the interrupt enable register
-u8 cpu_get_ie_register();
+u8 cpu_get_ie_register(gb_t *gb);
 
 // Sets the interrupt enable register
-void cpu_set_ie_register(u8 n);
+void cpu_set_ie_register(gb_t *gb, u8 n);
 
 // Gets the interrupt flags
-u8 cpu_get_int_flags();
+u8 cpu_get_int_flags(gb_t *gb);
 
 // Sets the interrupt flags
-void cpu_set_int_flags(u8 n);
+void cpu_set_int_flags(gb_t *gb, u8 n);
 
 // Converts an instruction to its string representation
 void instr_to_str(cpu_context *ctx, char *str);
\ No newline at end of file
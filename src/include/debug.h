@@ -2,8 +2,16 @@
 
 #include <common.h>
 
+// Serial output collected from the game
+typedef struct {
+    char msg[1024];
+    int size;
+    int printed; // Size when last printed
+    bool quiet;  // Collect without printing
+} debug_context;
+
 // Updates the debug information
-void debug_update();
+void debug_update(gb_t *gb);
 
 // Prints the debug information
-void debug_print();
\ No newline at end of file
+void debug_print(gb_t *gb);
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include <common.h>
 
+// Ticks in one LCD frame
+#define TICKS_PER_FRAME 70224
+
 typedef struct {
     bool paused;
     bool running;
@@ -9,11 +12,12 @@ typedef struct {
     bool die;
 } emu_context;
 
-// Initializes and runs the emulator
-int emu_run(int argc, char **argv);
+// Increments the emulator cycle count
+void emu_cycles(gb_t *gb, int cpu_cycles);
 
-// Global emulator context
-emu_context *emu_get_context();
+// Advances the emulator clock by the given number of ticks at once, with the
+// same result as emu_cycles ticking them one by one
+void emu_skip(gb_t *gb, u32 ticks);
 
-// Increments the emulator cycle count
-void emu_cycles(int cpu_cycles);
\ No newline at end of file
+// Runs the CPU until the clock reaches the next frame boundary
+void emu_run_frame(gb_t *gb);
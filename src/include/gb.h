@@ -0,0 +1,92 @@
+#pragma once
+
+#include <common.h>
+#include <emu.h>
+#include <cpu.h>
+#include <bus.h>
+#include <ram.h>
+#include <io.h>
+#include <timer.h>
+#include <cart.h>
+#include <rtc.h>
+#include <scheduler.h>
+#include <block.h>
+#include <idle.h>
+#include <jit.h>
+#include <aot.h>
+#include <debug.h>
+#include <trace.h>
+#include <stddef.h>
+
+// An emulated Game Boy
+// Every component keeps its state here and every function of the emulator
+// library takes the instance it works on, so any number of instances can run
+// side by side, each on its own thread. What is shared between instances is
+// read-only once set up: the ALU tables, the opcode handlers and AOT code.
+// Opcode profiling and instruction tracing are development builds only.
+// Profiles count for the whole process, each instance traces to its own ring.
+struct gb {
+    // First, so the opcode handlers get from their cpu_context to the
+    // instance without a pointer of their own (see GB)
+    _Alignas(64) cpu_context cpu;
+
+    emu_context emu;
+    sched_context sched;
+    bus_context bus;
+    io_context io;
+    timer_context timer;
+    ram_context ram;
+    cart_context cart;
+    rtc_context rtc;
+    idle_context idle;
+    debug_context debug;
+    trace_context trace;
+    jit_context jit;
+    aot_context aot;
+    block_cache block;
+};
+
+_Static_assert(offsetof(gb_t, cpu) == 0, "the CPU context must come first");
+
+// The instance a CPU context belongs to
+#define GB(ctx) ((gb_t *)(ctx))
+
+// Creates an instance in its power-on state, without a cartridge
+gb_t *gb_create();
+
+// Flushes the save file and releases everything the instance holds
+void gb_destroy(gb_t *gb);
+
+// Reads a byte from the bus at the given address
+static inline u8 bus_read(gb_t *gb, u16 address) {
+    u8 *page = gb->bus.read_pages[address >> 8];
+
+    return page ? page[address & 0xFF] : bus_read_slow(gb, address);
+}
+
+// Writes a byte to the bus at the given address
+static inline void bus_write(gb_t *gb, u16 address, u8 value) {
+    u8 *page = gb->bus.write_pages[address >> 8];
+
+    if (page) {
+        page[address & 0xFF] = value;
+    } else {
+        bus_write_slow(gb, address, value);
+    }
+}
+
+// Must be called for every write to WRAM/HRAM
+static inline void block_ram_write(gb_t *gb, u16 address) {
+    if (gb->block.code_lines[(address - 0xC000) >> 4]) {
+        block_ram_written(gb);
+    }
+}
+
+// Must be called whenever a cached block is about to run
+static inline void idle_enter(gb_t *gb, code_block *b) {
+    if (b->idle) {
+        idle_check(gb, b);
+    }
+
+    gb->idle.prev_block = b;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <common.h>
+#include <cpu.h>
+#include <block.h>
+
+// Idle loop fast-forward
+// A block that branches back to its own start and never writes memory does
+// the same thing on every iteration once it is entered twice in a row with
+// the same registers, until something it reads changes. Instead of running
+// those iterations, the clock skips whole iterations up to the next event
+// that could change what the loop sees (DIV or TIMA changing, the timer
+// interrupt), but never more than one frame at a time. Loops the detector
+// misses can be listed per ROM in an override file (see idle_load).
+
+// Flags in code_block.idle
+#define IDLE_LOOP       0x01 // The block may be an idle loop
+#define IDLE_LISTED     0x02 // Listed in the override file
+#define IDLE_READS_DIV  0x04 // Reads DIV
+#define IDLE_READS_TIMA 0x08 // Reads TIMA
+#define IDLE_READS_IF   0x10 // Reads IF
+#define IDLE_READS_ANY  (IDLE_READS_DIV | IDLE_READS_TIMA | IDLE_READS_IF)
+
+// Maximum number of loops listed in the override file for one ROM
+#define IDLE_MAX_LISTED 64
+
+typedef struct {
+    u16 bank;
+    u16 pc;
+} idle_addr;
+
+typedef struct {
+    idle_addr listed[IDLE_MAX_LISTED];
+    int num_listed;
+
+    // State at the last entry of an idle loop candidate
+    struct {
+        code_block *block;
+        u16 pc;
+        u16 bank;
+        cpu_registers regs;
+        u64 ticks;
+        u64 event; // Tick of the next event the loop could see
+    } last;
+
+    // The block entered last (NULL after code outside the block cache)
+    code_block *prev_block;
+
+    // Ticks skipped so far
+    u64 skipped_ticks;
+} idle_context;
+
+// Returns the idle flags of a freshly decoded block
+u8 idle_analyze(gb_t *gb, code_block *b);
+
+// Skips ahead if b is an idle loop that has reached a steady state
+void idle_check(gb_t *gb, code_block *b);
+
+// Loads the idle loops listed for the current cartridge from an override
+// file. Each line is the SHA-1 of a ROM followed by bank:address pairs in
+// hex, e.g. "<sha1> 00:0150 01:4A2C". Lines starting with # are ignored.
+bool idle_load(gb_t *gb, const char *path);
+
+// Forgets the listed loops and the steady state tracking
+void idle_reset(gb_t *gb);
+
+// idle_enter, which must be called whenever a cached block is about to run,
+// is inline in gb.h
@@ -124,5 +124,8 @@ typedef struct {
 // Returns the instruction given by the opcode
 instruction *instruction_by_opcode(u8 opcode);
 
+// Returns the length in bytes of the instruction (opcode and operands)
+u8 instr_length(instruction *instr);
+
 // Returns the name of the instruction given by the type
 char *inst_name(in_type t);
\ No newline at end of file
@@ -11,7 +11,7 @@ typedef enum {
 } interrupt_type;
 
 // Requests an interrupt
-void cpu_request_interrupt(interrupt_type type);
+void cpu_request_interrupt(gb_t *gb, interrupt_type type);
 
 // Handles all interrupts
 void cpu_handle_interrupts(cpu_context *ctx);
\ No newline at end of file
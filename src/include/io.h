@@ -2,8 +2,50 @@
 
 #include <common.h>
 
+// IO register dispatch
+// Every register in 0xFF00 - 0xFF7F has a read and a write handler and a
+// mask of unused bits, which read back as 1. Components register their own
+// ranges (io_register); anything unregistered reports "Unsupported". With
+// GBEMU_PROFILE defined, reads and writes are also counted per register and
+// listed by profile_report.
+
+// Reads an IO register
+typedef u8 (*IO_READ)(gb_t *gb, u16 address);
+
+// Writes an IO register
+typedef void (*IO_WRITE)(gb_t *gb, u16 address, u8 value);
+
+typedef struct {
+    IO_READ read;
+    IO_WRITE write;
+    u8 unused; // Bits that read as 1
+#ifdef GBEMU_PROFILE
+    u64 reads;
+    u64 writes;
+#endif
+} io_reg;
+
+typedef struct {
+    io_reg regs[0x80]; // Indexed by address - 0xFF00
+    u8 serial_data[2];
+} io_context;
+
+// Sets every register to unsupported except the serial port
+void io_init(gb_t *gb);
+
+// Sets the handlers for count registers from address (NULL for unsupported)
+void io_register(gb_t *gb, u16 address, u16 count, IO_READ read, IO_WRITE write, u8 unused);
+
 // Reads a byte from the given IO address
-u8 io_read(u16 addr);
+u8 io_read(gb_t *gb, u16 addr);
 
 // Writes a byte to the given IO address
-void io_write(u16 addr, u8 value);
\ No newline at end of file
+void io_write(gb_t *gb, u16 addr, u8 value);
+
+#ifdef GBEMU_PROFILE
+
+// Returns the number of reads and writes of the register at address
+u64 io_read_count(gb_t *gb, u16 address);
+u64 io_write_count(gb_t *gb, u16 address);
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <common.h>
+#include <block.h>
+
+// x86-64 dynamic recompiler
+// Blocks from the block cache that run often enough are translated into
+// native code. Simple register instructions are emitted inline, everything
+// else calls the opcode's specialized handler, so IO accesses, interrupts and
+// cycle accounting go through exactly the same code as the interpreter.
+
+// Number of runs before a block is recompiled
+#define JIT_THRESHOLD 64
+
+// Code buffer of an instance, allocated on first use
+typedef struct {
+    u8 *buffer;
+    u8 *code; // Next free byte in the buffer
+    bool failed;
+} jit_context;
+
+#ifdef GBEMU_JIT
+
+#if !(defined(__x86_64__) && defined(__linux__))
+#error "GBEMU_JIT requires x86-64 Linux"
+#endif
+
+// Translates a block into native code (sets b->native).
+// Returns false if the block cannot be translated.
+bool jit_compile(gb_t *gb, code_block *b);
+
+// Releases the code buffer
+void jit_free(gb_t *gb);
+
+#else
+
+static inline bool jit_compile(gb_t *gb, code_block *b) { return false; }
+static inline void jit_free(gb_t *gb) {}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <common.h>
+
+// Opcode sequence profiling
+// Compiled out unless GBEMU_PROFILE is defined, in which case every executed
+// instruction is counted together with the one or two instructions that fell
+// through into it. The counts across a set of ROMs show which sequences are
+// worth fusing into superinstructions (see fused_ops in cpu_ops.c). They are
+// kept for the whole process, so profile one instance at a time.
+
+#ifdef GBEMU_PROFILE
+
+// Counts the instruction about to execute at pc
+void profile_step(gb_t *gb, u16 pc);
+
+// Prints the most frequent opcode pairs and triples, and the IO register
+// accesses of gb
+void profile_report(gb_t *gb, int count);
+
+#else
+
+static inline void profile_step(gb_t *gb, u16 pc) {}
+static inline void profile_report(gb_t *gb, int count) {}
+
+#endif
@@ -2,14 +2,22 @@
 
 #include <common.h>
 
+typedef struct {
+    u8 wram[0x2000];
+    u8 hram[0x80];
+} ram_context;
+
+// Maps WRAM into the bus page table
+void ram_init(gb_t *gb);
+
 // Returns the value at the given address in WRAM
-u8 wram_read(u16 address);
+u8 wram_read(gb_t *gb, u16 address);
 
 // Writes the given value to the given address in WRAM
-void wram_write(u16 address, u8 value);
+void wram_write(gb_t *gb, u16 address, u8 value);
 
 // Returns the value at the given address in HRAM
-u8 hram_read(u16 address);
+u8 hram_read(gb_t *gb, u16 address);
 
 // Writes the given value to the given address in HRAM
-void hram_write(u16 address, u8 value);
\ No newline at end of file
+void hram_write(gb_t *gb, u16 address, u8 value);
\ No newline at end of file
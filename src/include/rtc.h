@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common.h>
+
+// MBC3 real-time clock
+// The clock is not ticked. Its registers hold the time as of a reference
+// reading of the emulated clock (or of the host clock in real time mode) and
+// are brought up to date only when the game latches or writes them.
+
+// Size of the clock state appended to the save file. The layout is the one
+// BGB and VBA use: the registers and the latched registers as 32 bit words,
+// followed by the 64 bit host time in seconds they were stored at.
+#define RTC_SAVE_SIZE 48
+
+typedef struct {
+    u8 regs[5];     // Seconds, minutes, hours, day low, day high/halt/carry
+    u8 latched[5];
+    bool latch;     // 0 was written to the latch register
+    bool realtime;  // Follow host time instead of the emulated clock
+    u64 ref;        // Clock reading the registers are current as of
+    u8 *save;       // State in the save file, NULL if there is none
+} rtc_context;
+
+// Resets the clock for a new cartridge. save points at its state in the save
+// file, or is NULL if it has none. If loaded is set, the state found there is
+// restored and advanced by the host time passed since it was stored.
+void rtc_init(gb_t *gb, u8 *save, bool loaded);
+
+// Reads a latched register (0x08 - 0x0C)
+u8 rtc_read(gb_t *gb, u8 reg);
+
+// Writes a register (0x08 - 0x0C)
+void rtc_write(gb_t *gb, u8 reg, u8 value);
+
+// Handles a write to the latch register, writing 0 then 1 latches the time
+void rtc_latch(gb_t *gb, u8 value);
+
+// Stores the current time and the host time in the save file
+void rtc_store(gb_t *gb);
+
+// Makes the clock follow host time instead of the emulated clock
+void rtc_set_realtime(gb_t *gb, bool on);
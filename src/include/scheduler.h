@@ -0,0 +1,46 @@
+#pragma once
+
+#include <common.h>
+
+// Event scheduler
+// Components are not ticked. A component that will do something at a known
+// future tick (the timer overflow interrupt, and later PPU mode changes, DMA
+// or serial transfers) schedules an event for it, and brings its own
+// registers up to date from the clock whenever the CPU accesses them.
+// emu_cycles only advances the clock and runs the events that are due.
+
+// Scheduled events, each one is pending at most once
+typedef enum {
+    SCHED_TIMER, // TIMA overflow
+    SCHED_SAVE,  // Battery RAM flush at a frame boundary
+    SCHED_EVENT_COUNT
+} sched_event;
+
+// Runs an event, given the tick it was scheduled for
+typedef void (*SCHED_CALLBACK)(gb_t *gb, u64 when);
+
+typedef struct {
+    u64 when;
+    SCHED_CALLBACK cb;
+    int pos; // Index in heap, -1 if not pending
+} sched_entry;
+
+// Pending events are kept in a binary min-heap ordered by deadline
+typedef struct {
+    u64 deadline; // Tick of the earliest pending event (UINT64_MAX if there is none)
+    sched_entry events[SCHED_EVENT_COUNT];
+    u8 heap[SCHED_EVENT_COUNT];
+    int heap_len;
+} sched_context;
+
+// Schedules an event for the given tick, replacing it if already pending
+void sched_add(gb_t *gb, sched_event ev, u64 when, SCHED_CALLBACK cb);
+
+// Cancels an event if it is pending
+void sched_cancel(gb_t *gb, sched_event ev);
+
+// Runs every event due at or before now, earliest first
+void sched_run(gb_t *gb, u64 now);
+
+// Cancels every event
+void sched_reset(gb_t *gb);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <common.h>
+
+// SHA-1 digest of len bytes of data
+void sha1(const u8 *data, size_t len, u8 digest[20]);
+
+// SHA-1 digest of len bytes of data as a 40 character hex string
+void sha1_hex(const u8 *data, size_t len, char hex[41]);
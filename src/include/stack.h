@@ -1,17 +1,18 @@
 #pragma once
 
 #include <common.h>
+#include <cpu.h>
 
 // Defines the Gameboy CPU (LR35902) stack
 
 // Pushes a byte onto the stack
-void stack_push(u8 data);
+void stack_push(cpu_context *ctx, u8 data);
 
 // Pushes a 16-bit word onto the stack
-void stack_push16(u16 data);
+void stack_push16(cpu_context *ctx, u16 data);
 
 // Pops a byte from the stack
-u8 stack_pop();
+u8 stack_pop(cpu_context *ctx);
 
 // Pops a 16-bit word from the stack
-u16 stack_pop16();
\ No newline at end of file
+u16 stack_pop16(cpu_context *ctx);
\ No newline at end of file
@@ -2,7 +2,13 @@
 
 #include <common.h>
 
+// The timer is not ticked. The registers are stored as of the last write
+// (or TIMA overflow), reads compute DIV and TIMA from the emulator clock,
+// and TIMA overflow is a scheduled event so the interrupt is requested on
+// time. Writes model the falling edges a DIV reset or TAC change causes.
+
 typedef struct {
+    u64 ticks; // Emulator tick the registers below are current at
     u16 div; // Divider register
     u8 tima; // Timer counter
     u8 tma; // Timer modulo
@@ -10,16 +16,33 @@ typedef struct {
 } timer_context;
 
 // Initializes the timer
-void timer_init();
+void timer_init(gb_t *gb);
+
+// Advances the timer registers by one tick
+void timer_tick(gb_t *gb);
+
+// Advances the timer by the given number of ticks at once, leaving it in
+// the same state as that many timer_tick calls
+void timer_skip(gb_t *gb, u32 ticks);
+
+// Brings the timer registers up to date with the emulator clock
+void timer_sync(gb_t *gb);
 
-// Updates the timer
-void timer_tick();
+// Reschedules the overflow event after the timer context was changed directly
+void timer_reschedule(gb_t *gb);
+
+// Returns the number of ticks until the value read from DIV changes
+u32 timer_ticks_to_div(gb_t *gb);
+
+// Returns the number of ticks until TIMA next increments (0 if stopped)
+u32 timer_ticks_to_tima(gb_t *gb);
+
+// Returns the number of ticks until TIMA next overflows and requests the
+// timer interrupt (0 if stopped)
+u32 timer_ticks_to_overflow(gb_t *gb);
 
 // Writes to the timer
-void timer_write(u16 address, u8 value);
+void timer_write(gb_t *gb, u16 address, u8 value);
 
 // Reads from the timer
-u8 timer_read(u16 address);
-
-// Gets the timer context
-timer_context *timer_get_context();
\ No newline at end of file
+u8 timer_read(gb_t *gb, u16 address);
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <common.h>
+#include <cpu.h>
+
+// Binary instruction tracing.
+// Compiled out unless GBEMU_TRACE is defined, in which case every executed
+// instruction is pushed as a fixed-size record into a lock-free ring buffer
+// and a separate thread decodes the records to text. Every instance has its
+// own ring and decoder thread, so each ring has a single producer.
+
+// One executed instruction (registers are sampled before it executes)
+typedef struct {
+    u64 ticks;        // Emulator tick count
+    u16 pc;           // Address of the opcode
+    u16 sp;           // Stack Pointer
+    u8 opcode;        // Opcode (0xCB for prefixed instructions)
+    u8 operands[2];   // Operand bytes (0 past the end of the instruction)
+    u8 a;
+    u8 f;
+    u8 b;
+    u8 c;
+    u8 d;
+    u8 e;
+    u8 h;
+    u8 l;
+    u8 pad[8];
+} trace_record;
+
+typedef struct trace_ring trace_ring;
+
+// Trace ring of an instance (NULL unless tracing)
+typedef struct {
+    trace_ring *ring;
+} trace_context;
+
+#ifdef GBEMU_TRACE
+
+// Allocates the instance's ring and starts its decoder thread (gb_create
+// calls it)
+void trace_init(gb_t *gb);
+
+// Prints the records still in the instance's ring, stops its decoder thread
+// and releases the ring (gb_destroy calls it). The rings of the instances
+// still alive are printed at exit, so nothing traced before exit() is lost.
+void trace_free(gb_t *gb);
+
+// Starts a record for the instruction about to execute at pc. Compiled code
+// passes the operand bytes it was built from, the interpreter passes 0 and
+// its operand fetches fill them in through trace_operand.
+void trace_step(cpu_context *ctx, u16 pc, u8 opcode, u16 operands);
+
+// Records an operand byte of the instruction traced last as it is fetched
+void trace_operand(cpu_context *ctx, u8 value);
+
+#else
+
+static inline void trace_init(gb_t *gb) {}
+static inline void trace_free(gb_t *gb) {}
+static inline void trace_step(cpu_context *ctx, u16 pc, u8 opcode, u16 operands) {}
+static inline void trace_operand(cpu_context *ctx, u8 value) {}
+
+#endif
+
+// Formats a trace record as a line of text
+void trace_format(const trace_record *rec, char *str, size_t size);
@@ -0,0 +1,91 @@
+#include <alu.h>
+#include <pthread.h>
+
+u16 alu_add_table[2][256][256];
+u16 alu_sub_table[2][256][256];
+u16 alu_inc_table[256];
+u16 alu_dec_table[256];
+u16 alu_daa_table[8][256];
+u16 alu_shift_table[8][2][256];
+
+// Instances created on several threads at once build the tables once
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+
+// Packs a result and its flags into a table entry
+static u16 entry(u8 r, bool z, bool n, bool h, bool c) {
+    return r | (z << 15) | (n << 14) | (h << 13) | (c << 12);
+}
+
+static u8 shift(alu_shift_op op, u8 v, u8 c, u8 *carry) {
+    switch (op) {
+        case ALU_RLC: *carry = v >> 7; return (v << 1) | (v >> 7);
+        case ALU_RRC: *carry = v & 1; return (v >> 1) | (v << 7);
+        case ALU_RL: *carry = v >> 7; return (v << 1) | c;
+        case ALU_RR: *carry = v & 1; return (v >> 1) | (c << 7);
+        case ALU_SLA: *carry = v >> 7; return v << 1;
+        case ALU_SRA: *carry = v & 1; return (int8_t)v >> 1;
+        case ALU_SWAP: *carry = 0; return (v >> 4) | (v << 4);
+        case ALU_SRL: *carry = v & 1; return v >> 1;
+    }
+
+    return 0;
+}
+
+static void build_tables() {
+    for (int c = 0; c < 2; c++) {
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                int r = a + b + c;
+                alu_add_table[c][a][b] = entry(r, (r & 0xFF) == 0, 0, (a & 0xF) + (b & 0xF) + c > 0xF, r > 0xFF);
+
+                r = a - b - c;
+                alu_sub_table[c][a][b] = entry(r, (r & 0xFF) == 0, 1, (a & 0xF) - (b & 0xF) - c < 0, r < 0);
+            }
+        }
+    }
+
+    for (int v = 0; v < 256; v++) {
+        u8 r = v + 1;
+        alu_inc_table[v] = entry(r, r == 0, 0, (r & 0xF) == 0, 0);
+
+        r = v - 1;
+        alu_dec_table[v] = entry(r, r == 0, 1, (r & 0xF) == 0xF, 0);
+    }
+
+    for (int nhc = 0; nhc < 8; nhc++) {
+        bool n = nhc & 4;
+        bool h = nhc & 2;
+        bool c = nhc & 1;
+
+        for (int a = 0; a < 256; a++) {
+            u8 u = 0;
+            bool cf = false;
+
+            if (h || (!n && (a & 0xF) > 9)) {
+                u = 6;
+            }
+
+            if (c || (!n && a > 0x99)) {
+                u |= 0x60;
+                cf = true;
+            }
+
+            u8 r = n ? a - u : a + u;
+            alu_daa_table[nhc][a] = entry(r, r == 0, n, 0, cf);
+        }
+    }
+
+    for (int op = 0; op < 8; op++) {
+        for (int c = 0; c < 2; c++) {
+            for (int v = 0; v < 256; v++) {
+                u8 carry;
+                u8 r = shift(op, v, c, &carry);
+                alu_shift_table[op][c][v] = entry(r, r == 0, 0, 0, carry);
+            }
+        }
+    }
+}
+
+void alu_init() {
+    pthread_once(&initialized, build_tables);
+}
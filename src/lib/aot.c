@@ -0,0 +1,406 @@
+#include <gb.h>
+#include <interrupts.h>
+#include <trace.h>
+#include <sha1.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+// Headers the generated C is compiled against
+#ifndef GBEMU_INCLUDE_DIR
+#define GBEMU_INCLUDE_DIR "include"
+#endif
+
+static const aot_runtime runtime = {
+    .emu_cycles = emu_cycles,
+    .debug_update = debug_update,
+    .debug_print = debug_print,
+#ifdef GBEMU_TRACE
+    .trace_step = trace_step,
+#endif
+    .handle_interrupts = cpu_handle_interrupts,
+    .op_handlers = op_handlers
+};
+
+// 8-bit registers in opcode order (B, C, D, E, H, L, (HL), A)
+static const char *reg_names[8] = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+
+// 16-bit registers in opcode order
+static const char *pair_names[4] = {"bc", "de", "hl", "sp"};
+
+// Blocks found by the static pass (ROM 0x0000 - 0x7FFF)
+typedef struct {
+    gb_t *gb;
+    u8 queued[0x8000];
+    u8 compiled[0x8000];
+    u16 worklist[0x8000];
+    int worklist_len;
+} aot_pass;
+
+// Generated code shared by every block
+static const char *prelude =
+    "#include <gb.h>\n"
+    "\n"
+    "static aot_runtime rt;\n"
+    "\n"
+    "// Opcode fetch\n"
+    "#define STEP(addr, op, operands) \\\n"
+    "    if (rt.trace_step) rt.trace_step(ctx, addr, op, operands); \\\n"
+    "    rt.emu_cycles(GB(ctx), 1); \\\n"
+    "    rt.debug_update(GB(ctx)); \\\n"
+    "    rt.debug_print(GB(ctx))\n"
+    "\n"
+    "// Runs an opcode through its specialized handler\n"
+    "#define HANDLER(op, addr) \\\n"
+    "    ctx->regs.pc = addr; \\\n"
+    "    rt.op_handlers[op](ctx)\n"
+    "\n"
+    "// Interrupts and the delayed EI, leaves the block if an interrupt was taken\n"
+    "#define END() \\\n"
+    "    if (ctx->interrupt_master_enabled) { \\\n"
+    "        if (ctx->int_pending) { \\\n"
+    "            rt.handle_interrupts(ctx); \\\n"
+    "            ctx->enabling_ime = false; \\\n"
+    "            return; \\\n"
+    "        } \\\n"
+    "        ctx->enabling_ime = false; \\\n"
+    "    } \\\n"
+    "    if (ctx->enabling_ime) ctx->interrupt_master_enabled = true\n"
+    "\n"
+    "// Leaves the block if cached code or banks changed\n"
+    "#define SYNC() if (GB(ctx)->block.gen != gen) return\n"
+    "\n"
+    "#define INC(r) \\\n"
+    "    r++; \\\n"
+    "    cpu_lazy_flags(ctx, LF_INC, 0, cpu_flag_c(ctx), r)\n"
+    "\n"
+    "#define DEC(r) \\\n"
+    "    r--; \\\n"
+    "    cpu_lazy_flags(ctx, LF_DEC, 0, cpu_flag_c(ctx), r)\n"
+    "\n";
+
+// Queues a block start found by the static pass
+static void add_leader(aot_pass *p, u32 pc) {
+    if (pc < 0x8000 && !p->queued[pc]) {
+        p->queued[pc] = 1;
+        p->worklist[p->worklist_len++] = pc;
+    }
+}
+
+static u16 bank_of(gb_t *gb, u16 pc) {
+    return pc < 0x4000 ? 0 : cart_rom_bank(gb);
+}
+
+// Queues the blocks an instruction can continue to
+static void add_successors(aot_pass *p, instruction *instr, u16 pc, u16 next) {
+    u16 nn = bus_read(p->gb, pc + 1) | (bus_read(p->gb, pc + 2) << 8);
+
+    switch (instr->type) {
+        case IN_JP:
+            // JP HL targets are only known at run time
+            if (instr->mode == AM_D16) {
+                add_leader(p, nn);
+            }
+            break;
+
+        case IN_JR:
+            add_leader(p, next + (int8_t)bus_read(p->gb, pc + 1));
+            break;
+
+        case IN_CALL:
+            add_leader(p, nn);
+            add_leader(p, next);
+            break;
+
+        case IN_RST:
+            add_leader(p, instr->param);
+            add_leader(p, next);
+            break;
+
+        case IN_RET:
+        case IN_RETI:
+        case IN_NONE:
+            break;
+
+        default:
+            add_leader(p, next);
+            return;
+    }
+
+    if (instr->cond != CT_NONE) {
+        add_leader(p, next);
+    }
+}
+
+// Emits C for simple instructions.
+// Returns false if the instruction must go through its handler.
+static bool emit_native(gb_t *gb, FILE *f, u8 op, u16 pc, u16 next) {
+    u8 n = bus_read(gb, pc + 1);
+    u16 nn = n | (bus_read(gb, pc + 2) << 8);
+    u8 dst = (op >> 3) & 7;
+    u8 src = op & 7;
+
+    if (op == 0x00) {
+        // NOP
+    } else if (op >= 0x40 && op < 0x80 && op != 0x76 && dst != 6 && src != 6) {
+        fprintf(f, "    ctx->regs.%s = ctx->regs.%s;\n", reg_names[dst], reg_names[src]);
+    } else if ((op & 0xC7) == 0x06 && dst != 6) {
+        fprintf(f, "    rt.emu_cycles(GB(ctx), 1);\n");
+        fprintf(f, "    ctx->regs.%s = 0x%02X;\n", reg_names[dst], n);
+    } else if ((op & 0xCF) == 0x01) {
+        fprintf(f, "    rt.emu_cycles(GB(ctx), 2);\n");
+        fprintf(f, "    ctx->regs.%s = 0x%04X;\n", pair_names[op >> 4], nn);
+    } else if ((op & 0xC7) == 0x04 && dst != 6) {
+        fprintf(f, "    INC(ctx->regs.%s);\n", reg_names[dst]);
+    } else if ((op & 0xC7) == 0x05 && dst != 6) {
+        fprintf(f, "    DEC(ctx->regs.%s);\n", reg_names[dst]);
+    } else if (op == 0xAF) {
+        fprintf(f, "    ctx->regs.a = 0;\n");
+        fprintf(f, "    cpu_set_f(ctx, 0x80);\n");
+    } else if (op == 0x18) {
+        fprintf(f, "    rt.emu_cycles(GB(ctx), 2);\n");
+        next += (int8_t)n;
+    } else if (op == 0xC3) {
+        fprintf(f, "    rt.emu_cycles(GB(ctx), 3);\n");
+        next = nn;
+    } else if ((op & 0xE7) == 0x20) {
+        // JR cc, e
+        fprintf(f, "    rt.emu_cycles(GB(ctx), 1);\n");
+        fprintf(f, "    if (%scpu_flag_%s(ctx)) {\n", op & 0x08 ? "" : "!", op & 0x10 ? "c" : "z");
+        fprintf(f, "        rt.emu_cycles(GB(ctx), 1);\n");
+        fprintf(f, "        ctx->regs.pc = 0x%04X;\n", (u16)(next + (int8_t)n));
+        fprintf(f, "    } else {\n");
+        fprintf(f, "        ctx->regs.pc = 0x%04X;\n", next);
+        fprintf(f, "    }\n");
+        return true;
+    } else {
+        return false;
+    }
+
+    fprintf(f, "    ctx->regs.pc = 0x%04X;\n", next);
+    return true;
+}
+
+// Emits the block starting at pc using the same rules as the block cache
+static void emit_block(aot_pass *p, FILE *f, u16 pc) {
+    gb_t *gb = p->gb;
+    u16 bank = bank_of(gb, pc);
+    u32 end = block_region_end(pc);
+    u32 addr = pc;
+
+    // An instruction straddling the end of the region runs in the
+    // interpreter, only the code after it is compiled
+    instruction *first = instruction_by_opcode(bus_read(gb, pc));
+
+    if (pc + instr_length(first) > end) {
+        add_successors(p, first, pc, pc + instr_length(first));
+        return;
+    }
+
+    fprintf(f, "static void b%04X_%04X(cpu_context *ctx) {\n", bank, pc);
+    fprintf(f, "    u32 gen = GB(ctx)->block.gen;\n");
+    fprintf(f, "    (void)gen;\n");
+
+    for (int count = 0; count < BLOCK_MAX_INSTRS; count++) {
+        u8 opcode = bus_read(gb, addr);
+        instruction *instr = instruction_by_opcode(opcode);
+        u8 len = instr_length(instr);
+        u16 next = addr + len;
+
+        // End before an instruction that would straddle the end of the
+        // region, so what follows is still queued
+        bool straddle = next >= end ||
+            next + instr_length(instruction_by_opcode(bus_read(gb, next))) > end;
+        bool last = block_ends(instr) || count + 1 == BLOCK_MAX_INSTRS || straddle;
+
+        // Disassemble for the comment
+        cpu_context tmp = {0};
+        tmp.curr_opcode = opcode;
+        tmp.curr_instr = instr;
+        tmp.fetched_data = bus_read(gb, addr + 1) | (bus_read(gb, addr + 2) << 8);
+        tmp.mem_dest = tmp.fetched_data;
+
+        char str[32];
+        instr_to_str(&tmp, str);
+
+        fprintf(f, "\n    // %04X: %s\n", addr, str);
+        fprintf(f, "    STEP(0x%04X, 0x%02X, 0x%04X);\n", addr, opcode,
+            tmp.fetched_data & (len > 2 ? 0xFFFF : len > 1 ? 0xFF : 0));
+
+        if (!emit_native(gb, f, opcode, addr, next)) {
+            fprintf(f, "    HANDLER(0x%02X, 0x%04X);\n", opcode, (u16)(addr + 1));
+        }
+
+        fprintf(f, "    END();\n");
+
+        if (last) {
+            add_successors(p, instr, addr, next);
+            break;
+        }
+
+        fprintf(f, "    SYNC();\n");
+        addr = next;
+    }
+
+    fprintf(f, "}\n\n");
+    p->compiled[pc] = 1;
+}
+
+bool aot_compile(gb_t *gb, const char *dir) {
+    char sha[41];
+    char c_path[1024];
+    char so_path[1024];
+
+    sha1_hex(cart_rom_data(gb), cart_rom_size(gb), sha);
+    snprintf(c_path, sizeof(c_path), "%s/%s.c", dir, sha);
+    snprintf(so_path, sizeof(so_path), "%s/%s.so", dir, sha);
+
+    FILE *f = fopen(c_path, "w");
+
+    if (!f) {
+        printf("AOT: failed to create %s\n", c_path);
+        return false;
+    }
+
+    aot_pass *p = calloc(1, sizeof(aot_pass));
+
+    if (!p) {
+        fclose(f);
+        return false;
+    }
+
+    p->gb = gb;
+
+    // Entry point, RST vectors and interrupt vectors
+    add_leader(p, 0x100);
+
+    for (u16 v = 0; v <= 0x60; v += 8) {
+        add_leader(p, v);
+    }
+
+    fprintf(f, "// Generated by gbrecomp, do not edit\n");
+    fprintf(f, "%s", prelude);
+
+    while (p->worklist_len) {
+        emit_block(p, f, p->worklist[--p->worklist_len]);
+    }
+
+    // Lookup table, sorted by (bank, pc)
+    u32 count = 0;
+
+    fprintf(f, "int aot_version = AOT_VERSION;\n");
+    fprintf(f, "const char aot_sha1[] = \"%s\";\n\n", sha);
+    fprintf(f, "const aot_block aot_blocks[] = {\n");
+
+    for (u32 pc = 0; pc < 0x8000; pc++) {
+        if (p->compiled[pc]) {
+            fprintf(f, "    {0x%04X, 0x%04X, b%04X_%04X},\n", bank_of(gb, pc), pc, bank_of(gb, pc), pc);
+            count++;
+        }
+    }
+
+    fprintf(f, "};\n\n");
+    fprintf(f, "const u32 aot_block_count = %u;\n\n", count);
+    fprintf(f, "void aot_init(const aot_runtime *runtime) {\n");
+    fprintf(f, "    rt = *runtime;\n");
+    fprintf(f, "}\n");
+    fclose(f);
+    free(p);
+
+    printf("AOT: %u blocks written to %s\n", count, c_path);
+
+    const char *cc = getenv("CC");
+    char cmd[4096];
+    snprintf(cmd, sizeof(cmd), "%s -O2 -shared -fPIC -I\"%s\" -o \"%s\" \"%s\"",
+        cc ? cc : "cc", GBEMU_INCLUDE_DIR, so_path, c_path);
+
+    if (system(cmd)) {
+        printf("AOT: failed to build %s\n", so_path);
+        return false;
+    }
+
+    printf("AOT: built %s\n", so_path);
+    return true;
+}
+
+bool aot_load(gb_t *gb, const char *dir) {
+    aot_context *ctx = &gb->aot;
+    char sha[41];
+    char path[1024];
+
+    aot_unload(gb);
+
+    sha1_hex(cart_rom_data(gb), cart_rom_size(gb), sha);
+    snprintf(path, sizeof(path), "%s/%s.so", dir, sha);
+
+    if (access(path, R_OK)) {
+        return false;
+    }
+
+    ctx->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!ctx->handle) {
+        printf("AOT: failed to load %s: %s\n", path, dlerror());
+        return false;
+    }
+
+    int *version = dlsym(ctx->handle, "aot_version");
+    const char *rom_sha = dlsym(ctx->handle, "aot_sha1");
+    const u32 *count = dlsym(ctx->handle, "aot_block_count");
+    void (*init)(const aot_runtime *) = dlsym(ctx->handle, "aot_init");
+    ctx->blocks = dlsym(ctx->handle, "aot_blocks");
+
+    if (!version || *version != AOT_VERSION || !rom_sha || strcmp(rom_sha, sha) ||
+        !count || !init || !ctx->blocks) {
+        printf("AOT: %s does not match this build, rebuild it with gbrecomp\n", path);
+        aot_unload(gb);
+        return false;
+    }
+
+    // The runtime is the same for every instance loading the object
+    init(&runtime);
+    ctx->num_blocks = *count;
+
+    // Blocks decoded before now have no native code
+    block_flush(gb);
+
+    printf("AOT: loaded %u blocks from %s\n", ctx->num_blocks, path);
+    return true;
+}
+
+void aot_unload(gb_t *gb) {
+    aot_context *ctx = &gb->aot;
+
+    if (ctx->handle) {
+        dlclose(ctx->handle);
+
+        // Cached blocks may point into the shared object
+        block_flush(gb);
+    }
+
+    ctx->handle = NULL;
+    ctx->blocks = NULL;
+    ctx->num_blocks = 0;
+}
+
+BLOCK_NATIVE aot_lookup(gb_t *gb, u16 bank, u16 pc) {
+    const aot_block *blocks = gb->aot.blocks;
+    u32 key = (bank << 16) | pc;
+    u32 lo = 0;
+    u32 hi = gb->aot.num_blocks;
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        u32 k = (blocks[mid].bank << 16) | blocks[mid].pc;
+
+        if (k == key) {
+            return blocks[mid].fn;
+        } else if (k < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,160 @@
+#include <gb.h>
+#include <string.h>
+
+bool block_ends(instruction *instr) {
+    switch (instr->type) {
+        case IN_NONE:
+        case IN_JR:
+        case IN_JP:
+        case IN_CALL:
+        case IN_RET:
+        case IN_RETI:
+        case IN_RST:
+        case IN_HALT:
+        case IN_STOP:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+u32 block_region_end(u16 pc) {
+    if (pc < 0x4000) {
+        return 0x4000;
+    } else if (pc < 0x8000) {
+        return 0x8000;
+    } else if (BETWEEN(pc, 0xC000, 0xDFFF)) {
+        return 0xE000;
+    } else if (BETWEEN(pc, 0xFF80, 0xFFFE)) {
+        return 0xFFFF;
+    }
+
+    return 0;
+}
+
+// Substitutes fused handlers for the opcode sequences in fused_ops
+static void fuse(code_block *b) {
+    for (int i = 0; i < b->count; i++) {
+        for (int f = 0; f < fused_op_count; f++) {
+            const fused_op *op = &fused_ops[f];
+
+            if (i + op->count > b->count) {
+                continue;
+            }
+
+            int n = 0;
+
+            while (n < op->count && b->instrs[i + n].opcode == op->opcodes[n]) {
+                n++;
+            }
+
+            if (n == op->count) {
+                b->instrs[i].handler = op->handler;
+                b->instrs[i].fused = op->count - 1;
+                i += op->count - 1;
+                break;
+            }
+        }
+    }
+}
+
+// Decodes the block starting at pc into b
+static void decode(gb_t *gb, code_block *b, u16 pc, u16 bank, u32 end) {
+    b->pc = pc;
+    b->bank = bank;
+    b->ram = pc >= 0xC000;
+    b->gen = gb->block.gen;
+    b->count = 0;
+    b->runs = 0;
+    b->cycles = 0;
+    b->native = b->ram ? NULL : aot_lookup(gb, bank, pc);
+
+    u32 addr = pc;
+
+    while (b->count < BLOCK_MAX_INSTRS) {
+        u8 opcode = bus_read(gb, addr);
+        instruction *instr = instruction_by_opcode(opcode);
+        u8 len = instr_length(instr);
+
+        // Never let an instruction straddle the end of the region
+        if (addr + len > end) {
+            break;
+        }
+
+        block_instr *in = &b->instrs[b->count++];
+        in->handler = op_handlers[opcode];
+        in->opcode = opcode;
+        in->next_pc = addr + len;
+        in->fused = 0;
+
+        addr += len;
+
+        if (block_ends(instr)) {
+            break;
+        }
+    }
+
+    fuse(b);
+
+    b->idle = b->count ? idle_analyze(gb, b) : 0;
+
+    // Remember which RAM lines now hold cached code, and send writes to
+    // their pages through the handlers so they see block_ram_write
+    if (b->ram) {
+        for (u32 a = pc; a < addr; a += 16) {
+            gb->block.code_lines[(a - 0xC000) >> 4] = 1;
+            bus_protect_write(gb, a);
+        }
+
+        gb->block.code_lines[(addr - 1 - 0xC000) >> 4] = 1;
+        bus_protect_write(gb, addr - 1);
+    }
+}
+
+code_block *block_lookup(gb_t *gb, u16 pc) {
+    u32 end = block_region_end(pc);
+
+    if (!end) {
+        return NULL;
+    }
+
+    u16 bank = 0;
+
+    if (pc < 0x4000) {
+        bank = cart_rom_bank0(gb);
+    } else if (pc < 0x8000) {
+        bank = cart_rom_bank(gb);
+    }
+
+    code_block *b = &gb->block.blocks[(pc ^ (bank << 12)) & (BLOCK_CACHE_SIZE - 1)];
+
+    if (b->count && b->pc == pc && b->bank == bank && (!b->ram || b->gen == gb->block.gen)) {
+        return b;
+    }
+
+    decode(gb, b, pc, bank, end);
+
+    return b->count ? b : NULL;
+}
+
+void block_flush(gb_t *gb) {
+    memset(gb->block.blocks, 0, sizeof(gb->block.blocks));
+    memset(gb->block.code_lines, 0, sizeof(gb->block.code_lines));
+    bus_unprotect_writes(gb);
+    gb->block.gen++;
+}
+
+void block_drop_native(gb_t *gb) {
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        code_block *b = &gb->block.blocks[i];
+        b->native = b->ram ? NULL : aot_lookup(gb, b->bank, b->pc);
+    }
+}
+
+void block_ram_written(gb_t *gb) {
+    // Every RAM block decoded before now is stale
+    memset(gb->block.code_lines, 0, sizeof(gb->block.code_lines));
+    bus_unprotect_writes(gb);
+    gb->block.gen++;
+}
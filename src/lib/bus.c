@@ -1,8 +1,5 @@
-#include <bus.h>
-#include <cart.h>
-#include <ram.h>
-#include <cpu.h>
-#include <io.h>
+#include <gb.h>
+#include <string.h>
 
 // 0x0000 - 0x3FFF: 16KB ROM bank 00 (in cartridge, fixed at bank 00)
 // 0x4000 - 0x7FFF: 16KB ROM Bank 01..NN (in cartridge, switchable bank number)
@@ -17,10 +14,30 @@
 // 0xFF80 - 0xFFFE: High RAM (HRAM)
 // 0xFFFF: Interrupt Enable Register
 
-u8 bus_read(u16 address) {
+void bus_map(gb_t *gb, u16 start, u32 size, u8 *read, u8 *write) {
+    bus_context *bus = &gb->bus;
+
+    for (u32 offset = 0; offset < size; offset += 0x100) {
+        u8 page = (start + offset) >> 8;
+
+        bus->read_pages[page] = read ? read + offset : NULL;
+        bus->write_pages[page] = write ? write + offset : NULL;
+        bus->mapped_write_pages[page] = bus->write_pages[page];
+    }
+}
+
+void bus_protect_write(gb_t *gb, u16 address) {
+    gb->bus.write_pages[address >> 8] = NULL;
+}
+
+void bus_unprotect_writes(gb_t *gb) {
+    memcpy(gb->bus.write_pages, gb->bus.mapped_write_pages, sizeof(gb->bus.write_pages));
+}
+
+u8 bus_read_slow(gb_t *gb, u16 address) {
     // ROM banks located at 0x0000 - 0x7FFF
     if (address < 0x8000) {
-        return cart_read(address);
+        return cart_read(gb, address);
     } else if (address < 0xA000) {
         // Char/Map Data
         // TODO
@@ -29,10 +46,10 @@ u8 bus_read(u16 address) {
         return 0x0;
     } else if (address < 0xC000) {
         // Cartridge RAM
-        return cart_read(address);
+        return cart_read(gb, address);
     } else if (address < 0xE000) {
         // WRAM (Working RAM)
-        return wram_read(address);
+        return wram_read(gb, address);
     } else if (address < 0xFE00) {
         // Reserved ECHO RAM
         return 0;
@@ -47,19 +64,19 @@ u8 bus_read(u16 address) {
         return 0;
     } else if (address < 0xFF80) {
         // I/O Registers
-        return io_read(address);
+        return io_read(gb, address);
     } else if (address == 0xFFFF) {
         // CPU Interrupt Enable Register
-        return cpu_get_ie_register();
+        return cpu_get_ie_register(gb);
     }
     
-    return hram_read(address);
+    return hram_read(gb, address);
 }
 
-void bus_write(u16 address, u8 value) {
+void bus_write_slow(gb_t *gb, u16 address, u8 value) {
     // ROM banks located at 0x0000 - 0x7FFF
     if (address < 0x8000) {
-        cart_write(address, value);
+        cart_write(gb, address, value);
     } else if (address < 0xA000) {
         // Char/Map Data
         // TODO
@@ -67,10 +84,10 @@ void bus_write(u16 address, u8 value) {
         // NO_IMPL
     } else if (address < 0xC000) {
         // Cartridge RAM
-        cart_write(address, value);
+        cart_write(gb, address, value);
     } else if (address < 0xE000) {
         // WRAM (Working RAM)
-        wram_write(address, value);
+        wram_write(gb, address, value);
     } else if (address < 0xFE00) {
         // Reserved ECHO RAM
     } else if (address < 0xFEA0) {
@@ -82,24 +99,24 @@ void bus_write(u16 address, u8 value) {
         // Not Usable
     } else if (address < 0xFF80) {
         // I/O Registers
-        io_write(address, value);
+        io_write(gb, address, value);
     } else if (address == 0xFFFF) {
         // CPU Interrupt Enable Register
-        cpu_set_ie_register(value);
+        cpu_set_ie_register(gb, value);
     } else {
         // High RAM
-        hram_write(address, value);
+        hram_write(gb, address, value);
     }
 }
 
-u16 bus_read16(u16 address) {
-    u16 lo = bus_read(address);
-    u16 hi = bus_read(address + 1);
+u16 bus_read16(gb_t *gb, u16 address) {
+    u16 lo = bus_read(gb, address);
+    u16 hi = bus_read(gb, address + 1);
     return lo | (hi << 8);
 }
 
-void bus_write16(u16 address, u16 value) {
+void bus_write16(gb_t *gb, u16 address, u16 value) {
     // Write the high byte first
-    bus_write(address + 1, (value >> 8) & 0xFF);
-    bus_write(address, value & 0xFF);
+    bus_write(gb, address + 1, (value >> 8) & 0xFF);
+    bus_write(gb, address, value & 0xFF);
 }
\ No newline at end of file
@@ -1,15 +1,12 @@
-#include <cart.h>
+#include <gb.h>
+#include <string.h>
 
-// Cartridge context
-typedef struct {
-    char filename[1024]; // Filename of the cartridge
-    u32 rom_size;        // Size of the ROM
-    u8 *rom_data;        // Pointer to the ROM data
-    rom_header *header;  // Pointer to cartridge header
-} cart_context;
-
-// Global cartridge context
-static cart_context ctx;
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 // ROM types
 static const char *ROM_TYPES[] = {
@@ -116,76 +113,547 @@ static const char *LIC_CODE[0xA5] = {
 };
 
 // Get the name of the cartridge licensee
-const char *cart_lic_name() {
+const char *cart_lic_name(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
     // Only valid up to 0xA4
-    if (ctx.header->new_lic_code <= 0xA4) {
-        return LIC_CODE[ctx.header->lic_code];
+    if (ctx->header->new_lic_code <= 0xA4) {
+        return LIC_CODE[ctx->header->lic_code];
     }
 
     return "UNKNOWN";
 }
 
 // Get the name of the cartridge type
-const char *cart_type_name() {
+const char *cart_type_name(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
     // Only valid up to 0x22
-    if (ctx.header->type <= 0x22) {
-        return ROM_TYPES[ctx.header->type];
+    if (ctx->header->type <= 0x22) {
+        return ROM_TYPES[ctx->header->type];
     }
 
     return "UNKNOWN";
 }
 
-bool cart_load(char *cart) {
-    snprintf(ctx.filename, sizeof(ctx.filename), "%s", cart);
+// Returns the memory bank controller for a cartridge type
+static cart_mbc mbc_of(u8 type) {
+    switch (type) {
+        case 0x00:
+        case 0x08:
+        case 0x09:
+            return MBC_NONE;
+        case 0x01 ... 0x03:
+            return MBC_1;
+        case 0x05 ... 0x06:
+            return MBC_2;
+        case 0x0F ... 0x13:
+            return MBC_3;
+        case 0x19 ... 0x1E:
+            return MBC_5;
+    }
+
+    printf("\t Unsupported cartridge type %2.2X, running it as ROM only\n", type);
+    return MBC_NONE;
+}
+
+// True if the cartridge type keeps its RAM (or clock) powered by a battery
+static bool has_battery(u8 type) {
+    switch (type) {
+        case 0x03:
+        case 0x06:
+        case 0x09:
+        case 0x0D:
+        case 0x0F:
+        case 0x10:
+        case 0x13:
+        case 0x1B:
+        case 0x1E:
+        case 0x22:
+            return true;
+    }
+
+    return false;
+}
+
+// True if an MBC3 maps its clock registers at 0xA000 - 0xBFFF
+static bool rtc_selected(cart_context *ctx) {
+    return ctx->mbc == MBC_3 && ctx->bank2 >= 0x08;
+}
+
+// External RAM sizes by header RAM size code
+static const u32 RAM_SIZES[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+// Recomputes the bank pointers from the MBC registers and maps them into the
+// bus, so banked memory is read as directly as ROM-only carts
+static void update_banks(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+    u32 lo = 0;
+    u32 hi = ctx->rom_bank;
+    u32 ram = 0;
+
+    switch (ctx->mbc) {
+        case MBC_NONE:
+            hi = 1;
+            break;
+        case MBC_1:
+            // The upper bits select the ROM bank, or in mode 1 also the
+            // bank at 0x0000 and the RAM bank
+            hi |= ctx->bank2 << 5;
+
+            if (ctx->mode) {
+                lo = ctx->bank2 << 5;
+                ram = ctx->bank2;
+            }
+            break;
+        case MBC_2:
+            break;
+        case MBC_3:
+        case MBC_5:
+            ram = ctx->bank2;
+            break;
+    }
+
+    lo %= ctx->rom_banks;
+    hi %= ctx->rom_banks;
+
+    // Code cached from the old banks must not run any further
+    if (lo != ctx->bank_lo || hi != ctx->bank_hi) {
+        gb->block.gen++;
+    }
+
+    ctx->bank_lo = lo;
+    ctx->bank_hi = hi;
+    ctx->rom_lo = ctx->rom_data + lo * 0x4000;
+    ctx->rom_hi = ctx->rom_data + hi * 0x4000;
+
+    bus_map(gb, 0x0000, 0x4000, ctx->rom_lo, NULL);
+    bus_map(gb, 0x4000, 0x4000, ctx->rom_hi, NULL);
+
+    // MBC2 nibble RAM, MBC3 RTC registers and 2KB RAM stay behind cart_read
+    ctx->ram = NULL;
+    bus_map(gb, 0xA000, 0x2000, NULL, NULL);
+
+    if (!ctx->ram_enabled || !ctx->ram_data || ctx->mbc == MBC_2 || rtc_selected(ctx)) {
+        return;
+    }
+
+    ctx->ram = ctx->ram_data + (ram * 0x2000) % ctx->ram_size;
+
+    if (ctx->ram_size >= 0x2000) {
+        bus_map(gb, 0xA000, 0x2000, ctx->ram, ctx->ram);
+    }
+}
+
+// Hands battery RAM written since the last flush to the kernel for writeback.
+// MS_ASYNC only schedules the dirty pages, so the CPU thread never waits on
+// the disk, and the page cache already holds every write should we crash.
+static void save_flush(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+#ifndef _WIN32
+    if (ctx->save && ctx->ram_dirty) {
+        rtc_store(gb);
+        msync(ctx->save, ctx->save_size, MS_ASYNC);
+    }
+#endif
+
+    // RAM that stays enabled can be written again before the next flush
+    ctx->ram_dirty = ctx->ram_enabled;
+}
+
+// Flushes at every frame boundary for as long as the game keeps RAM enabled
+static void save_event(gb_t *gb, u64 when) {
+    save_flush(gb);
+
+    if (gb->cart.ram_dirty) {
+        sched_add(gb, SCHED_SAVE, when + TICKS_PER_FRAME, save_event);
+    }
+}
+
+// Starts or stops the frame flushes when the game enables or disables RAM
+static void ram_enable_changed(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+    if (!ctx->save) {
+        return;
+    }
+
+    if (ctx->ram_enabled) {
+        u64 frame = gb->emu.ticks / TICKS_PER_FRAME + 1;
+
+        ctx->ram_dirty = true;
+        sched_add(gb, SCHED_SAVE, frame * TICKS_PER_FRAME, save_event);
+    } else {
+        // Games disable RAM once they are done saving
+        save_flush(gb);
+        sched_cancel(gb, SCHED_SAVE);
+    }
+}
+
+// Maps the .sav file next to the ROM, so the game writes battery RAM straight
+// into the page cache. Sets old_size to the size the file had before, and
+// returns NULL if the file cannot be used.
+static u8 *map_save(const char *rom, u32 size, u32 *old_size) {
+#ifndef _WIN32
+    char path[1024 + 4];
+    snprintf(path, sizeof(path), "%s", rom);
 
-    FILE *fp = fopen(cart, "r");
+    char *ext = strrchr(path, '.');
+
+    if (ext && !strchr(ext, '/')) {
+        *ext = 0;
+    }
+
+    strcat(path, ".sav");
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        printf("\t Failed to open save file: %s\n", path);
+        return NULL;
+    }
+
+    // A new or short save file is zero filled up to the size
+    struct stat st;
+
+    if (fstat(fd, &st) || (st.st_size < size && ftruncate(fd, size))) {
+        printf("\t Failed to size save file: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        printf("\t Failed to map save file: %s\n", path);
+        return NULL;
+    }
+
+    printf("\t Save     : %s\n", path);
+
+    *old_size = st.st_size;
+    return data;
+#else
+    return NULL;
+#endif
+}
+
+// Releases the external RAM of the previous cartridge, flushing its save
+static void unload_ram(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+    sched_cancel(gb, SCHED_SAVE);
+
+#ifndef _WIN32
+    if (ctx->save) {
+        rtc_store(gb);
+        msync(ctx->save, ctx->save_size, MS_ASYNC);
+        munmap(ctx->save, ctx->save_size);
+        ctx->ram_data = NULL;
+    }
+#endif
+
+    free(ctx->ram_data);
+    ctx->ram_data = NULL;
+    ctx->save = NULL;
+    ctx->save_size = 0;
+    ctx->ram_dirty = false;
+}
+
+// Sets up the MBC and external RAM for the loaded ROM
+static void init_mbc(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+    unload_ram(gb);
+
+    ctx->mbc = mbc_of(ctx->header->type);
+    ctx->rtc = ctx->header->type == 0x0F || ctx->header->type == 0x10;
+    ctx->ram_size = ctx->mbc == MBC_2 ? 0x200 :
+        ctx->header->ram_size < 6 ? RAM_SIZES[ctx->header->ram_size] : 0;
+    ctx->ram_mask = (ctx->ram_size < 0x2000 ? ctx->ram_size : 0x2000) - 1;
+
+    u32 save_size = ctx->ram_size + (ctx->rtc ? RTC_SAVE_SIZE : 0);
+    u32 old_size = 0;
+
+    if (save_size && has_battery(ctx->header->type)) {
+        ctx->save = map_save(ctx->filename, save_size, &old_size);
+    }
+
+    if (ctx->save) {
+        ctx->save_size = save_size;
+        ctx->ram_data = ctx->ram_size ? ctx->save : NULL;
+    } else if (ctx->ram_size) {
+        ctx->ram_data = calloc(1, ctx->ram_size);
+    }
+
+    // The clock state follows the RAM, older saves may not have it yet
+    rtc_init(gb, ctx->rtc && ctx->save ? ctx->save + ctx->ram_size : NULL, old_size >= save_size);
+
+    // ROM only carts have no RAM enable register
+    ctx->ram_enabled = ctx->mbc == MBC_NONE;
+    ctx->rom_bank = 1;
+    ctx->bank2 = 0;
+    ctx->mode = false;
+
+    // ROM only carts with a battery keep RAM enabled all the time
+    ram_enable_changed(gb);
+
+    update_banks(gb);
+}
+
+// Releases the ROM image of the previous cartridge
+static void unload_rom(gb_t *gb) {
+    cart_context *ctx = &gb->cart;
+
+#ifndef _WIN32
+    if (ctx->rom_mapped) {
+        munmap(ctx->rom_data, ctx->rom_mapped);
+        ctx->rom_data = NULL;
+    }
+#endif
+
+    free(ctx->rom_data);
+    ctx->rom_data = NULL;
+    ctx->rom_mapped = 0;
+}
+
+// Loads the ROM image. The file is mapped read-only when it already holds
+// whole banks, so every instance and process running it shares the page
+// cache copy; anything else is copied and padded to whole banks.
+static bool load_rom(gb_t *gb, const char *path) {
+    cart_context *ctx = &gb->cart;
+
+    FILE *fp = fopen(path, "rb");
 
     if (!fp) {
-        printf("Failed to open: %s\n", cart);
+        printf("Failed to open: %s\n", path);
         return false;
     }
 
-    printf("Opened: %s\n", ctx.filename);
+    unload_rom(gb);
 
     fseek(fp, 0, SEEK_END);
-    ctx.rom_size = ftell(fp);
-
+    ctx->rom_size = ftell(fp);
     rewind(fp);
 
-    ctx.rom_data = malloc(ctx.rom_size);
-    fread(ctx.rom_data, ctx.rom_size, 1, fp);
+    // Whole banks, at least two, so every bank pointer stays in the image
+    ctx->rom_banks = (ctx->rom_size + 0x3FFF) / 0x4000;
+
+    if (ctx->rom_banks < 2) {
+        ctx->rom_banks = 2;
+    }
+
+#ifndef _WIN32
+    if (ctx->rom_size == ctx->rom_banks * 0x4000) {
+        void *data = mmap(NULL, ctx->rom_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+        if (data != MAP_FAILED) {
+            fclose(fp);
+            ctx->rom_data = data;
+            ctx->rom_mapped = ctx->rom_size;
+            return true;
+        }
+    }
+#endif
+
+    ctx->rom_data = calloc(ctx->rom_banks, 0x4000);
+    fread(ctx->rom_data, ctx->rom_size, 1, fp);
     fclose(fp);
 
+    return true;
+}
+
+bool cart_load(gb_t *gb, char *cart) {
+    cart_context *ctx = &gb->cart;
+
+    snprintf(ctx->filename, sizeof(ctx->filename), "%s", cart);
+
+    if (!load_rom(gb, cart)) {
+        return false;
+    }
+
+    printf("Opened: %s\n", ctx->filename);
+
+    // Code cached or compiled for a previous cartridge is no longer valid
+    aot_unload(gb);
+    idle_reset(gb);
+    block_flush(gb);
+
     // Header starts at 0x100
-    ctx.header = (rom_header *)(ctx.rom_data + 0x100);
-    ctx.header->title[15] = 0;
+    ctx->header = (const rom_header *)(ctx->rom_data + 0x100);
 
     printf("Cartridge Loaded:\n");
-    printf("\t Title    : %s\n", ctx.header->title);
-    printf("\t Type     : %2.2X (%s)\n", ctx.header->type, cart_type_name());
-    printf("\t ROM Size : %d KB\n", 32 << ctx.header->rom_size);
-    printf("\t RAM Size : %2.2X\n", ctx.header->ram_size);
-    printf("\t LIC Code : %2.2X (%s)\n", ctx.header->lic_code, cart_lic_name());
-    printf("\t ROM Vers : %2.2X\n", ctx.header->version);
+    printf("\t Title    : %.15s\n", ctx->header->title);
+    printf("\t Type     : %2.2X (%s)\n", ctx->header->type, cart_type_name(gb));
+    printf("\t ROM Size : %d KB\n", 32 << ctx->header->rom_size);
+    printf("\t RAM Size : %2.2X\n", ctx->header->ram_size);
+    printf("\t LIC Code : %2.2X (%s)\n", ctx->header->lic_code, cart_lic_name(gb));
+    printf("\t ROM Vers : %2.2X\n", ctx->header->version);
 
     // Check the header checksum
     u16 x = 0;
     for (u16 i=0x0134; i<=0x014C; i++) {
-        x = x - ctx.rom_data[i] - 1;
+        x = x - ctx->rom_data[i] - 1;
     }
 
-    printf("\t Checksum : %2.2X (%s)\n", ctx.header->checksum, (x & 0xFF) ? "PASSED" : "FAILED");
+    printf("\t Checksum : %2.2X (%s)\n", ctx->header->checksum, (x & 0xFF) ? "PASSED" : "FAILED");
+
+    init_mbc(gb);
 
     return true;
 }
 
-u8 cart_read(u16 address) {
-    // For now ROM only type supported
-    return ctx.rom_data[address];
+void cart_unload(gb_t *gb) {
+    unload_ram(gb);
+    unload_rom(gb);
 }
 
-void cart_write(u16 address, u8 value) {
-    // For now ROM only type supported so no write
-    printf("cart_write(0x%04X, 0x%02X)\n", address, value);
-    NO_IMPL;
+u8 cart_read(gb_t *gb, u16 address) {
+    cart_context *ctx = &gb->cart;
+
+    // Without a cartridge the bus reads open (0xFF)
+    if (!ctx->rom_data) {
+        return 0xFF;
+    }
+
+    if (address < 0x4000) {
+        return ctx->rom_lo[address];
+    } else if (address < 0x8000) {
+        return ctx->rom_hi[address - 0x4000];
+    }
+
+    // External RAM reads as open bus while disabled
+    if (!ctx->ram_enabled) {
+        return 0xFF;
+    }
+
+    if (rtc_selected(ctx)) {
+        return ctx->rtc && ctx->bank2 <= 0x0C ? rtc_read(gb, ctx->bank2) : 0xFF;
+    }
+
+    if (!ctx->ram_data) {
+        return 0xFF;
+    }
+
+    if (ctx->mbc == MBC_2) {
+        // 512 half-bytes, mirrored across the whole range
+        return 0xF0 | ctx->ram_data[address & 0x1FF];
+    }
+
+    return ctx->ram[(address - 0xA000) & ctx->ram_mask];
+}
+
+const u8 *cart_rom_data(gb_t *gb) {
+    return gb->cart.rom_data;
+}
+
+u32 cart_rom_size(gb_t *gb) {
+    return gb->cart.rom_size;
+}
+
+u16 cart_rom_bank(gb_t *gb) {
+    return gb->cart.bank_hi;
+}
+
+u16 cart_rom_bank0(gb_t *gb) {
+    return gb->cart.bank_lo;
+}
+
+// Writes an MBC register (0x0000 - 0x7FFF)
+static void mbc_write(gb_t *gb, u16 address, u8 value) {
+    cart_context *ctx = &gb->cart;
+
+    bool ram_enabled = ctx->ram_enabled;
+
+    switch (ctx->mbc) {
+        case MBC_NONE:
+            return;
+        case MBC_1:
+            if (address < 0x2000) {
+                ctx->ram_enabled = (value & 0x0F) == 0x0A;
+            } else if (address < 0x4000) {
+                ctx->rom_bank = (value & 0x1F) ? (value & 0x1F) : 1;
+            } else if (address < 0x6000) {
+                ctx->bank2 = value & 0x03;
+            } else {
+                ctx->mode = value & 0x01;
+            }
+            break;
+        case MBC_2:
+            // Address bit 8 selects between RAM enable and ROM bank
+            if (address >= 0x4000) {
+                return;
+            } else if (address & 0x100) {
+                ctx->rom_bank = (value & 0x0F) ? (value & 0x0F) : 1;
+            } else {
+                ctx->ram_enabled = (value & 0x0F) == 0x0A;
+            }
+            break;
+        case MBC_3:
+            if (address < 0x2000) {
+                ctx->ram_enabled = (value & 0x0F) == 0x0A;
+            } else if (address < 0x4000) {
+                ctx->rom_bank = (value & 0x7F) ? (value & 0x7F) : 1;
+            } else if (address < 0x6000) {
+                ctx->bank2 = value & 0x0F;
+            } else {
+                if (ctx->rtc) {
+                    rtc_latch(gb, value);
+                }
+                return;
+            }
+            break;
+        case MBC_5:
+            if (address < 0x2000) {
+                ctx->ram_enabled = (value & 0x0F) == 0x0A;
+            } else if (address < 0x3000) {
+                ctx->rom_bank = (ctx->rom_bank & 0x100) | value;
+            } else if (address < 0x4000) {
+                ctx->rom_bank = (ctx->rom_bank & 0xFF) | ((value & 0x01) << 8);
+            } else if (address < 0x6000) {
+                ctx->bank2 = value & 0x0F;
+            } else {
+                return;
+            }
+            break;
+    }
+
+    if (ctx->ram_enabled != ram_enabled) {
+        ram_enable_changed(gb);
+    }
+
+    update_banks(gb);
+}
+
+void cart_write(gb_t *gb, u16 address, u8 value) {
+    cart_context *ctx = &gb->cart;
+
+    if (address < 0x8000) {
+        mbc_write(gb, address, value);
+        return;
+    }
+
+    if (!ctx->ram_enabled) {
+        return;
+    }
+
+    if (rtc_selected(ctx)) {
+        if (ctx->rtc && ctx->bank2 <= 0x0C) {
+            rtc_write(gb, ctx->bank2, value);
+        }
+        return;
+    }
+
+    if (!ctx->ram_data) {
+        return;
+    }
+
+    if (ctx->mbc == MBC_2) {
+        ctx->ram_data[address & 0x1FF] = value & 0x0F;
+    } else if (ctx->ram) {
+        ctx->ram[(address - 0xA000) & ctx->ram_mask] = value;
+    }
 }
@@ -1,115 +1,216 @@
-#include <cpu.h>
-#include <bus.h>
-#include <emu.h>
+#include <alu.h>
+#include <gb.h>
 #include <interrupts.h>
-#include <debug.h>
-#include <timer.h>
-
-cpu_context ctx = {0};
-
-void cpu_init() {
-    ctx.regs.pc = 0x100;
-    ctx.regs.sp = 0xFFFE;
-    *((short *)&ctx.regs.a) = 0xB001;
-    *((short *)&ctx.regs.b) = 0x1300;
-    *((short *)&ctx.regs.d) = 0xD800;
-    *((short *)&ctx.regs.h) = 0x4D01;
-    ctx.ie_register = 0;
-    ctx.int_flags = 0;
-    ctx.interrupt_master_enabled = false;
-    ctx.enabling_ime = false;
-
-    timer_get_context()->div = 0xABCC;
+#include <trace.h>
+#include <profile.h>
+
+// gb_t keeps the context cache line aligned, so the hot state never
+// straddles two lines
+_Static_assert(offsetof(cpu_context, curr_instr) <= 64, "hot CPU state must fit in one cache line");
+
+static u8 int_flags_read(gb_t *gb, u16 address) {
+    return gb->cpu.int_flags;
+}
+
+static void int_flags_write(gb_t *gb, u16 address, u8 value) {
+    cpu_set_int_flags(gb, value);
+}
+
+void cpu_init(gb_t *gb) {
+    cpu_context *ctx = &gb->cpu;
+
+    ctx->regs.pc = 0x100;
+    ctx->regs.sp = 0xFFFE;
+    ctx->regs.af = 0x01B0;
+    ctx->regs.bc = 0x0013;
+    ctx->regs.de = 0x00D8;
+    ctx->regs.hl = 0x014D;
+    ctx->ie_register = 0;
+    ctx->int_flags = 0;
+    ctx->int_pending = 0;
+    ctx->interrupt_master_enabled = false;
+    ctx->enabling_ime = false;
+
+    // IF, the top three bits are unused
+    io_register(gb, 0xFF0F, 1, int_flags_read, int_flags_write, 0xE0);
+
+    gb->timer.div = 0xABCC;
+
+    alu_init();
 }
 
 // Fetches the next instruction
-static void fetch_instruction() {
+static void fetch_instruction(cpu_context *ctx) {
     // Fetch the next opcode and increement the program counter
-    ctx.curr_opcode = bus_read(ctx.regs.pc++);
+    ctx->curr_opcode = bus_read(GB(ctx), ctx->regs.pc++);
     // Get the instruction from the opcode
-    ctx.curr_instr = instruction_by_opcode(ctx.curr_opcode);
+    ctx->curr_instr = instruction_by_opcode(ctx->curr_opcode);
 }
 
-void fetch_data();
-
 // Execute the current instruction
-static void execute() {
+static void execute(cpu_context *ctx) {
     // Get the processor for the current instruction
-    IN_PROC proc = inst_get_processor(ctx.curr_instr->type);
+    IN_PROC proc = inst_get_processor(ctx->curr_instr->type);
 
     if (!proc) {
         NO_IMPL
     }
     
     // Execute the instruction
-    proc(&ctx);
+    proc(ctx);
 }
 
-bool cpu_step() {
-    // FDE cycle
-    if(!ctx.halted) {
-        u16 pc = ctx.regs.pc;
-        fetch_instruction();
-        emu_cycles(1);
-        fetch_data();
-
-        // Debug info
-        char flags[16];
-        sprintf(flags, "%c%c%c%c", 
-            ctx.regs.f & (1 << 7) ? 'Z' : '-',
-            ctx.regs.f & (1 << 6) ? 'N' : '-',
-            ctx.regs.f & (1 << 5) ? 'H' : '-',
-            ctx.regs.f & (1 << 4) ? 'C' : '-'
-        );
-
-        char instr[16];
-        instr_to_str(&ctx, instr);
-
-        printf("%08lX - %04X: %-12s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n", 
-            emu_get_context()->ticks,
-            pc, instr, ctx.curr_opcode,
-            bus_read(pc + 1), bus_read(pc + 2), ctx.regs.a, flags, ctx.regs.b, ctx.regs.c,
-            ctx.regs.d, ctx.regs.e, ctx.regs.h, ctx.regs.l);
-
-
-        if (ctx.curr_instr == NULL) {
-            printf("Unknown instruction! %02X\n", ctx.curr_opcode);
-            exit(-7);
+// Handles interrupts and the delayed EI at the end of an instruction
+static inline void end_instruction(cpu_context *ctx) {
+    if (ctx->interrupt_master_enabled) {
+        if (ctx->int_pending) {
+            cpu_handle_interrupts(ctx);
         }
 
-        debug_update();
-        debug_print();
+        ctx->enabling_ime = false;
+    }
 
-        execute();
-    } else {
-        // Halted
-        emu_cycles(1);
+    if (ctx->enabling_ime) {
+        ctx->interrupt_master_enabled = true;
+    }
+}
+
+// Runs a pre-decoded block until it ends, branches or its code goes stale
+static void run_block(gb_t *gb, code_block *b) {
+    cpu_context *ctx = &gb->cpu;
+    u32 gen = gb->block.gen;
+    u64 start = gb->emu.ticks;
+
+    b->runs++;
+
+    for (int i = 0; i < b->count; i++) {
+        block_instr *in = &b->instrs[i];
+        trace_step(ctx, ctx->regs.pc, in->opcode, 0);
+        profile_step(gb, ctx->regs.pc);
+
+        ctx->curr_opcode = in->opcode;
+        ctx->regs.pc++;
+        emu_cycles(gb, 1);
+
+        debug_update(gb);
+        debug_print(gb);
+
+        in->handler(ctx);
+        end_instruction(ctx);
+
+        // A fused handler also ran the instructions after it
+        i += in->fused;
 
-        if (ctx.int_flags) {
-            ctx.halted = false;
+        // Leave on taken branches, interrupts, HALT or code changes
+        if (ctx->regs.pc != b->instrs[i].next_pc || ctx->halted || gen != gb->block.gen) {
+            break;
         }
     }
 
-    if (ctx.interrupt_master_enabled) {
-        cpu_handle_interrupts(&ctx);
-        ctx.enabling_ime = false;
+    b->cycles += (gb->emu.ticks - start) / 4;
+}
+
+// Returns the ticks a halted CPU can skip: whole M-cycles up to and including
+// the one with the next scheduled event (the only way an interrupt can be
+// requested while halted), one frame at most
+static u32 halt_ticks(gb_t *gb) {
+    u64 now = gb->emu.ticks;
+    u32 ticks = TICKS_PER_FRAME;
+
+    if (gb->sched.deadline - now < ticks) {
+        ticks = gb->sched.deadline - now;
     }
 
-    if (ctx.enabling_ime) {
-        ctx.interrupt_master_enabled = true;
+    return (ticks + 3) & ~3;
+}
+
+bool cpu_step(gb_t *gb) {
+    cpu_context *ctx = &gb->cpu;
+
+    if (!ctx->halted && ctx->dispatch == DISPATCH_BLOCKS) {
+        code_block *b = block_lookup(gb, ctx->regs.pc);
+
+        if (b) {
+            // Idle loops may skip ahead to their next event first
+            idle_enter(gb, b);
+
+            if (b->native || (b->runs >= JIT_THRESHOLD && jit_compile(gb, b))) {
+                b->native(ctx);
+            } else {
+                run_block(gb, b);
+            }
+
+            return true;
+        }
     }
 
+    gb->idle.prev_block = NULL;
+
+    // FDE cycle
+    if(!ctx->halted) {
+        u16 pc = ctx->regs.pc;
+        profile_step(gb, pc);
+
+        if (ctx->dispatch != DISPATCH_TABLE) {
+            // Fetch the opcode and run its specialized handler
+            ctx->curr_opcode = bus_read(gb, ctx->regs.pc++);
+            trace_step(ctx, pc, ctx->curr_opcode, 0);
+            emu_cycles(gb, 1);
+
+            debug_update(gb);
+            debug_print(gb);
+
+            op_handlers[ctx->curr_opcode](ctx);
+        } else {
+            fetch_instruction(ctx);
+            trace_step(ctx, pc, ctx->curr_opcode, 0);
+            emu_cycles(gb, 1);
+            fetch_data(ctx);
+
+            if (ctx->curr_instr == NULL) {
+                printf("Unknown instruction! %02X\n", ctx->curr_opcode);
+                exit(-7);
+            }
+
+            debug_update(gb);
+            debug_print(gb);
+
+            execute(ctx);
+        }
+    } else {
+        // Halted
+        if (ctx->int_flags || ctx->enabling_ime) {
+            emu_cycles(gb, 1);
+        } else {
+            // Nothing changes until an interrupt is requested, so skip
+            // straight to the M-cycle in which that happens
+            emu_skip(gb, halt_ticks(gb));
+        }
+
+        if (ctx->int_flags) {
+            ctx->halted = false;
+        }
+    }
+
+    end_instruction(ctx);
+
     return true;
 }
 
-u8 cpu_get_ie_register() {
-    return ctx.ie_register;
+void cpu_set_dispatch(gb_t *gb, cpu_dispatch dispatch) {
+    gb->cpu.dispatch = dispatch;
+}
+
+u8 cpu_get_ie_register(gb_t *gb) {
+    return gb->cpu.ie_register;
 }
 
-void cpu_set_ie_register(u8 n) {
-    ctx.ie_register = n;
+void cpu_set_ie_register(gb_t *gb, u8 n) {
+    gb->cpu.ie_register = n;
+    cpu_update_int_pending(&gb->cpu);
 }
 
-void cpu_request_interrupt(interrupt_type t) {
-    ctx.int_flags |= t;
+void cpu_request_interrupt(gb_t *gb, interrupt_type t) {
+    gb->cpu.int_flags |= t;
+    cpu_update_int_pending(&gb->cpu);
 }
\ No newline at end of file
@@ -0,0 +1,770 @@
+#include <alu.h>
+#include <cpu.h>
+#include <gb.h>
+#include <emu.h>
+#include <stack.h>
+#include <block.h>
+#include <debug.h>
+#include <trace.h>
+#include <profile.h>
+
+// Specialized opcode handlers
+// Every opcode (and every CB-prefixed opcode) gets its own handler with the
+// addressing mode, registers and condition fixed at compile time, so there is
+// no instruction lookup, addressing mode switch or register switch at runtime.
+// The handlers are generated by the macros below and must behave exactly like
+// the table-driven path (fetch_data() + processors[]), including the order of
+// bus accesses and emu_cycles calls.
+
+// Read a register pair
+#define PAIR(hi, lo) (ctx->regs.hi##lo)
+
+// Write a register pair
+#define SET_PAIR(hi, lo, v) { ctx->regs.hi##lo = (v); }
+
+// Compose the F register from the four flag conditions
+#define FLAGS(z, n, h, c) (((z) ? 0x80 : 0) | ((n) ? 0x40 : 0) | ((h) ? 0x20 : 0) | ((c) ? 0x10 : 0))
+
+// Conditions
+#define COND_NONE true
+#define COND_NZ (!CPU_FLAG_Z)
+#define COND_Z CPU_FLAG_Z
+#define COND_NC (!CPU_FLAG_C)
+#define COND_C CPU_FLAG_C
+
+// Reads the 8-bit immediate at PC
+static inline u8 fetch8(cpu_context *ctx) {
+    u8 v = bus_read(GB(ctx), ctx->regs.pc);
+    trace_operand(ctx, v);
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.pc++;
+    return v;
+}
+
+// Reads the 16-bit immediate at PC
+static inline u16 fetch16(cpu_context *ctx) {
+    u16 lo = bus_read(GB(ctx), ctx->regs.pc);
+    trace_operand(ctx, lo);
+    emu_cycles(GB(ctx), 1);
+    u16 hi = bus_read(GB(ctx), ctx->regs.pc + 1);
+    trace_operand(ctx, hi);
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.pc += 2;
+    return lo | (hi << 8);
+}
+
+// 8-bit ALU operations on A
+// Flags are recorded for lazy evaluation (see lazy_flags in cpu.h)
+
+static inline void alu_add(cpu_context *ctx, u8 v) {
+    u8 a = ctx->regs.a;
+    u16 r = a + v;
+    ctx->regs.a = r;
+    cpu_lazy_flags(ctx, LF_ADD, a, v, r);
+}
+
+static inline void alu_adc(cpu_context *ctx, u8 v) {
+    u8 a = ctx->regs.a;
+    u16 r = a + v + CPU_FLAG_C;
+    ctx->regs.a = r;
+    cpu_lazy_flags(ctx, LF_ADD, a, v, r);
+}
+
+static inline void alu_sub(cpu_context *ctx, u8 v) {
+    u8 a = ctx->regs.a;
+    u16 r = a - v;
+    ctx->regs.a = r;
+    cpu_lazy_flags(ctx, LF_SUB, a, v, r);
+}
+
+static inline void alu_sbc(cpu_context *ctx, u8 v) {
+    u8 a = ctx->regs.a;
+    u16 r = a - v - CPU_FLAG_C;
+    ctx->regs.a = r;
+    cpu_lazy_flags(ctx, LF_SUB, a, v, r);
+}
+
+static inline void alu_and(cpu_context *ctx, u8 v) {
+    ctx->regs.a &= v;
+    cpu_lazy_flags(ctx, LF_AND, 0, 0, ctx->regs.a);
+}
+
+static inline void alu_xor(cpu_context *ctx, u8 v) {
+    ctx->regs.a ^= v;
+    cpu_lazy_flags(ctx, LF_LOGIC, 0, 0, ctx->regs.a);
+}
+
+static inline void alu_or(cpu_context *ctx, u8 v) {
+    ctx->regs.a |= v;
+    cpu_lazy_flags(ctx, LF_LOGIC, 0, 0, ctx->regs.a);
+}
+
+static inline void alu_cp(cpu_context *ctx, u8 v) {
+    u8 a = ctx->regs.a;
+    cpu_lazy_flags(ctx, LF_SUB, a, v, (u16)(a - v));
+}
+
+static inline u8 alu_inc(cpu_context *ctx, u8 v) {
+    v++;
+    cpu_lazy_flags(ctx, LF_INC, 0, CPU_FLAG_C, v);
+    return v;
+}
+
+static inline u8 alu_dec(cpu_context *ctx, u8 v) {
+    v--;
+    cpu_lazy_flags(ctx, LF_DEC, 0, CPU_FLAG_C, v);
+    return v;
+}
+
+static inline void alu_add_hl(cpu_context *ctx, u16 v) {
+    u16 hl = PAIR(h, l);
+    emu_cycles(GB(ctx), 1);
+    cpu_set_f(ctx, (cpu_get_f(ctx) & 0x80) | FLAGS(0, 0, (hl & 0xFFF) + (v & 0xFFF) >= 0x1000, (u32)hl + v >= 0x10000));
+    SET_PAIR(h, l, hl + v);
+}
+
+// CB rotate, shift and swap operations (alu_shift_table)
+
+static inline u8 cb_shift(cpu_context *ctx, alu_shift_op op, u8 v) {
+    // Only RL and RR shift the carry in
+    u16 e = alu_shift_table[op][(op == ALU_RL || op == ALU_RR) ? CPU_FLAG_C : 0][v];
+    cpu_set_f(ctx, ALU_FLAGS(e));
+    return ALU_RESULT(e);
+}
+
+static inline u8 cb_rlc(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_RLC, v); }
+static inline u8 cb_rrc(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_RRC, v); }
+static inline u8 cb_rl(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_RL, v); }
+static inline u8 cb_rr(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_RR, v); }
+static inline u8 cb_sla(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_SLA, v); }
+static inline u8 cb_sra(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_SRA, v); }
+static inline u8 cb_swap(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_SWAP, v); }
+static inline u8 cb_srl(cpu_context *ctx, u8 v) { return cb_shift(ctx, ALU_SRL, v); }
+
+static inline void cb_bit(cpu_context *ctx, u8 v, u8 bit) {
+    cpu_set_f(ctx, (cpu_get_f(ctx) & 0x10) | FLAGS(!(v & (1 << bit)), 0, 1, 0));
+}
+
+// Handler generators
+
+#define HANDLER(name) static void name(cpu_context *ctx)
+
+// LD r,r
+#define DEF_LD_R_R(opc, dst, src) HANDLER(op_##opc) { ctx->regs.dst = ctx->regs.src; }
+
+// LD r,(HL)
+#define DEF_LD_R_HL(opc, dst) HANDLER(op_##opc) { \
+    ctx->regs.dst = bus_read(GB(ctx), PAIR(h, l)); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// LD (HL),r
+#define DEF_LD_HL_R(opc, src) HANDLER(op_##opc) { \
+    bus_write(GB(ctx), PAIR(h, l), ctx->regs.src); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// LD r,n
+#define DEF_LD_R_D8(opc, dst) HANDLER(op_##opc) { ctx->regs.dst = fetch8(ctx); }
+
+// LD rr,nn
+#define DEF_LD_RR_D16(opc, hi, lo) HANDLER(op_##opc) { SET_PAIR(hi, lo, fetch16(ctx)); }
+
+// LD (rr),A
+#define DEF_LD_RR_A(opc, hi, lo) HANDLER(op_##opc) { \
+    bus_write(GB(ctx), PAIR(hi, lo), ctx->regs.a); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// LD A,(rr)
+#define DEF_LD_A_RR(opc, hi, lo) HANDLER(op_##opc) { \
+    ctx->regs.a = bus_read(GB(ctx), PAIR(hi, lo)); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// INC r / DEC r
+#define DEF_INC_R(opc, r) HANDLER(op_##opc) { ctx->regs.r = alu_inc(ctx, ctx->regs.r); }
+#define DEF_DEC_R(opc, r) HANDLER(op_##opc) { ctx->regs.r = alu_dec(ctx, ctx->regs.r); }
+
+// INC rr / DEC rr
+#define DEF_INC_RR(opc, hi, lo) HANDLER(op_##opc) { \
+    emu_cycles(GB(ctx), 1); \
+    SET_PAIR(hi, lo, PAIR(hi, lo) + 1); \
+}
+#define DEF_DEC_RR(opc, hi, lo) HANDLER(op_##opc) { \
+    emu_cycles(GB(ctx), 1); \
+    SET_PAIR(hi, lo, PAIR(hi, lo) - 1); \
+}
+
+// ADD HL,rr
+#define DEF_ADD_HL_RR(opc, hi, lo) HANDLER(op_##opc) { alu_add_hl(ctx, PAIR(hi, lo)); }
+
+// ALU A,r / ALU A,(HL) / ALU A,n
+#define DEF_ALU_R(opc, fn, r) HANDLER(op_##opc) { fn(ctx, ctx->regs.r); }
+#define DEF_ALU_HL(opc, fn) HANDLER(op_##opc) { \
+    u8 v = bus_read(GB(ctx), PAIR(h, l)); \
+    emu_cycles(GB(ctx), 1); \
+    fn(ctx, v); \
+}
+#define DEF_ALU_D8(opc, fn) HANDLER(op_##opc) { fn(ctx, fetch8(ctx)); }
+
+// JR cc,e
+#define DEF_JR(opc, cond) HANDLER(op_##opc) { \
+    int8_t rel = fetch8(ctx); \
+    if (cond) { \
+        ctx->regs.pc += rel; \
+        emu_cycles(GB(ctx), 1); \
+    } \
+}
+
+// JP cc,nn
+#define DEF_JP(opc, cond) HANDLER(op_##opc) { \
+    u16 addr = fetch16(ctx); \
+    if (cond) { \
+        ctx->regs.pc = addr; \
+        emu_cycles(GB(ctx), 1); \
+    } \
+}
+
+// CALL cc,nn
+#define DEF_CALL(opc, cond) HANDLER(op_##opc) { \
+    u16 addr = fetch16(ctx); \
+    if (cond) { \
+        emu_cycles(GB(ctx), 2); \
+        stack_push16(ctx, ctx->regs.pc); \
+        ctx->regs.pc = addr; \
+        emu_cycles(GB(ctx), 1); \
+    } \
+}
+
+// RET cc
+#define DEF_RET_CC(opc, cond) HANDLER(op_##opc) { \
+    emu_cycles(GB(ctx), 1); \
+    if (cond) { \
+        pop_pc(ctx); \
+    } \
+}
+
+// RST n
+#define DEF_RST(opc, addr) HANDLER(op_##opc) { \
+    emu_cycles(GB(ctx), 2); \
+    stack_push16(ctx, ctx->regs.pc); \
+    ctx->regs.pc = addr; \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// PUSH rr / POP rr
+#define DEF_PUSH(opc, hi, lo) HANDLER(op_##opc) { \
+    emu_cycles(GB(ctx), 1); \
+    stack_push(ctx, ctx->regs.hi); \
+    emu_cycles(GB(ctx), 1); \
+    stack_push(ctx, ctx->regs.lo); \
+    emu_cycles(GB(ctx), 1); \
+}
+#define DEF_POP(opc, hi, lo) HANDLER(op_##opc) { \
+    ctx->regs.lo = stack_pop(ctx); \
+    emu_cycles(GB(ctx), 1); \
+    ctx->regs.hi = stack_pop(ctx); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// CB op r / CB op (HL)
+// The prefix and the CB opcode take the first two cycles, (HL) adds a
+// read and, except for BIT, a write
+#define DEF_CB_R(opc, fn, r) HANDLER(cb_##opc) { \
+    ctx->regs.r = fn(ctx, ctx->regs.r); \
+}
+#define DEF_CB_HL(opc, fn) HANDLER(cb_##opc) { \
+    u16 hl = PAIR(h, l); \
+    u8 v = bus_read(GB(ctx), hl); \
+    emu_cycles(GB(ctx), 1); \
+    bus_write(GB(ctx), hl, fn(ctx, v)); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// BIT b,r / BIT b,(HL)
+#define DEF_BIT_R(opc, bit, r) HANDLER(cb_##opc) { \
+    cb_bit(ctx, ctx->regs.r, bit); \
+}
+#define DEF_BIT_HL(opc, bit) HANDLER(cb_##opc) { \
+    u8 v = bus_read(GB(ctx), PAIR(h, l)); \
+    emu_cycles(GB(ctx), 1); \
+    cb_bit(ctx, v, bit); \
+}
+
+// RES b,r / RES b,(HL)
+#define DEF_RES_R(opc, bit, r) HANDLER(cb_##opc) { \
+    ctx->regs.r &= ~(1 << bit); \
+}
+#define DEF_RES_HL(opc, bit) HANDLER(cb_##opc) { \
+    u16 hl = PAIR(h, l); \
+    u8 v = bus_read(GB(ctx), hl); \
+    emu_cycles(GB(ctx), 1); \
+    bus_write(GB(ctx), hl, v & ~(1 << bit)); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// SET b,r / SET b,(HL)
+#define DEF_SET_R(opc, bit, r) HANDLER(cb_##opc) { \
+    ctx->regs.r |= (1 << bit); \
+}
+#define DEF_SET_HL(opc, bit) HANDLER(cb_##opc) { \
+    u16 hl = PAIR(h, l); \
+    u8 v = bus_read(GB(ctx), hl); \
+    emu_cycles(GB(ctx), 1); \
+    bus_write(GB(ctx), hl, v | (1 << bit)); \
+    emu_cycles(GB(ctx), 1); \
+}
+
+// Expand a generator for the eight operands of a half row, in encoding order
+// (B, C, D, E, H, L, (HL), A). R generates the register forms, M the (HL) form.
+#define ROW_LO(R, M, X, ...) \
+    R(X##0, __VA_ARGS__, b) R(X##1, __VA_ARGS__, c) R(X##2, __VA_ARGS__, d) R(X##3, __VA_ARGS__, e) \
+    R(X##4, __VA_ARGS__, h) R(X##5, __VA_ARGS__, l) M(X##6, __VA_ARGS__) R(X##7, __VA_ARGS__, a)
+#define ROW_HI(R, M, X, ...) \
+    R(X##8, __VA_ARGS__, b) R(X##9, __VA_ARGS__, c) R(X##A, __VA_ARGS__, d) R(X##B, __VA_ARGS__, e) \
+    R(X##C, __VA_ARGS__, h) R(X##D, __VA_ARGS__, l) M(X##E, __VA_ARGS__) R(X##F, __VA_ARGS__, a)
+
+// Pops the return address into PC
+static inline void pop_pc(cpu_context *ctx) {
+    u16 lo = stack_pop(ctx);
+    emu_cycles(GB(ctx), 1);
+    u16 hi = stack_pop(ctx);
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.pc = (hi << 8) | lo;
+    emu_cycles(GB(ctx), 1);
+}
+
+// Invalid opcode
+HANDLER(op_invalid) {
+    printf("INVALID INSTRUCTION\n");
+    exit(-7);
+}
+
+// 0x0X
+HANDLER(op_00) {}
+DEF_LD_RR_D16(01, b, c)
+DEF_LD_RR_A(02, b, c)
+DEF_INC_RR(03, b, c)
+DEF_INC_R(04, b)
+DEF_DEC_R(05, b)
+DEF_LD_R_D8(06, b)
+HANDLER(op_07) {
+    ctx->regs.a = cb_shift(ctx, ALU_RLC, ctx->regs.a);
+    cpu_set_f(ctx, ctx->regs.f & 0x10);
+}
+HANDLER(op_08) {
+    u16 addr = fetch16(ctx);
+    emu_cycles(GB(ctx), 1);
+    bus_write16(GB(ctx), addr, ctx->regs.sp);
+    emu_cycles(GB(ctx), 1);
+}
+DEF_ADD_HL_RR(09, b, c)
+DEF_LD_A_RR(0A, b, c)
+DEF_DEC_RR(0B, b, c)
+DEF_INC_R(0C, c)
+DEF_DEC_R(0D, c)
+DEF_LD_R_D8(0E, c)
+HANDLER(op_0F) {
+    ctx->regs.a = cb_shift(ctx, ALU_RRC, ctx->regs.a);
+    cpu_set_f(ctx, ctx->regs.f & 0x10);
+}
+
+// 0x1X
+// STOP: skips its second byte and carries on (see proc_stop)
+HANDLER(op_10) {
+    fetch8(ctx);
+}
+DEF_LD_RR_D16(11, d, e)
+DEF_LD_RR_A(12, d, e)
+DEF_INC_RR(13, d, e)
+DEF_INC_R(14, d)
+DEF_DEC_R(15, d)
+DEF_LD_R_D8(16, d)
+HANDLER(op_17) {
+    ctx->regs.a = cb_shift(ctx, ALU_RL, ctx->regs.a);
+    cpu_set_f(ctx, ctx->regs.f & 0x10);
+}
+DEF_JR(18, COND_NONE)
+DEF_ADD_HL_RR(19, d, e)
+DEF_LD_A_RR(1A, d, e)
+DEF_DEC_RR(1B, d, e)
+DEF_INC_R(1C, e)
+DEF_DEC_R(1D, e)
+DEF_LD_R_D8(1E, e)
+HANDLER(op_1F) {
+    ctx->regs.a = cb_shift(ctx, ALU_RR, ctx->regs.a);
+    cpu_set_f(ctx, ctx->regs.f & 0x10);
+}
+
+// 0x2X
+DEF_JR(20, COND_NZ)
+DEF_LD_RR_D16(21, h, l)
+HANDLER(op_22) {
+    u16 hl = PAIR(h, l);
+    SET_PAIR(h, l, hl + 1);
+    bus_write(GB(ctx), hl, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+}
+DEF_INC_RR(23, h, l)
+DEF_INC_R(24, h)
+DEF_DEC_R(25, h)
+DEF_LD_R_D8(26, h)
+HANDLER(op_27) {
+    u16 e = alu_daa_table[(CPU_FLAG_N << 2) | (CPU_FLAG_H << 1) | CPU_FLAG_C][ctx->regs.a];
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e));
+}
+DEF_JR(28, COND_Z)
+DEF_ADD_HL_RR(29, h, l)
+HANDLER(op_2A) {
+    u16 hl = PAIR(h, l);
+    ctx->regs.a = bus_read(GB(ctx), hl);
+    emu_cycles(GB(ctx), 1);
+    SET_PAIR(h, l, hl + 1);
+}
+DEF_DEC_RR(2B, h, l)
+DEF_INC_R(2C, l)
+DEF_DEC_R(2D, l)
+DEF_LD_R_D8(2E, l)
+HANDLER(op_2F) {
+    ctx->regs.a = ~ctx->regs.a;
+    cpu_set_f(ctx, cpu_get_f(ctx) | FLAGS(0, 1, 1, 0));
+}
+
+// 0x3X
+DEF_JR(30, COND_NC)
+HANDLER(op_31) { ctx->regs.sp = fetch16(ctx); }
+HANDLER(op_32) {
+    u16 hl = PAIR(h, l);
+    SET_PAIR(h, l, hl - 1);
+    bus_write(GB(ctx), hl, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_33) {
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.sp++;
+}
+HANDLER(op_34) {
+    u16 hl = PAIR(h, l);
+    u8 v = bus_read(GB(ctx), hl);
+    emu_cycles(GB(ctx), 1);
+    bus_write(GB(ctx), hl, alu_inc(ctx, v));
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_35) {
+    u16 hl = PAIR(h, l);
+    u8 v = bus_read(GB(ctx), hl);
+    emu_cycles(GB(ctx), 1);
+    bus_write(GB(ctx), hl, alu_dec(ctx, v));
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_36) {
+    u8 v = fetch8(ctx);
+    bus_write(GB(ctx), PAIR(h, l), v);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_37) {
+    cpu_set_f(ctx, (cpu_get_f(ctx) & 0x80) | FLAGS(0, 0, 0, 1));
+}
+DEF_JR(38, COND_C)
+HANDLER(op_39) { alu_add_hl(ctx, ctx->regs.sp); }
+HANDLER(op_3A) {
+    u16 hl = PAIR(h, l);
+    ctx->regs.a = bus_read(GB(ctx), hl);
+    emu_cycles(GB(ctx), 1);
+    SET_PAIR(h, l, hl - 1);
+}
+HANDLER(op_3B) {
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.sp--;
+}
+DEF_INC_R(3C, a)
+DEF_DEC_R(3D, a)
+DEF_LD_R_D8(3E, a)
+HANDLER(op_3F) {
+    cpu_set_f(ctx, (cpu_get_f(ctx) & 0x80) | FLAGS(0, 0, 0, !CPU_FLAG_C));
+}
+
+// 0x40 - 0x6F: LD r,r / LD r,(HL)
+ROW_LO(DEF_LD_R_R, DEF_LD_R_HL, 4, b)
+ROW_HI(DEF_LD_R_R, DEF_LD_R_HL, 4, c)
+ROW_LO(DEF_LD_R_R, DEF_LD_R_HL, 5, d)
+ROW_HI(DEF_LD_R_R, DEF_LD_R_HL, 5, e)
+ROW_LO(DEF_LD_R_R, DEF_LD_R_HL, 6, h)
+ROW_HI(DEF_LD_R_R, DEF_LD_R_HL, 6, l)
+
+// 0x7X
+DEF_LD_HL_R(70, b)
+DEF_LD_HL_R(71, c)
+DEF_LD_HL_R(72, d)
+DEF_LD_HL_R(73, e)
+DEF_LD_HL_R(74, h)
+DEF_LD_HL_R(75, l)
+HANDLER(op_76) { ctx->halted = true; }
+DEF_LD_HL_R(77, a)
+ROW_HI(DEF_LD_R_R, DEF_LD_R_HL, 7, a)
+
+// 0x80 - 0xBF: ALU A,r / ALU A,(HL)
+ROW_LO(DEF_ALU_R, DEF_ALU_HL, 8, alu_add)
+ROW_HI(DEF_ALU_R, DEF_ALU_HL, 8, alu_adc)
+ROW_LO(DEF_ALU_R, DEF_ALU_HL, 9, alu_sub)
+ROW_HI(DEF_ALU_R, DEF_ALU_HL, 9, alu_sbc)
+ROW_LO(DEF_ALU_R, DEF_ALU_HL, A, alu_and)
+ROW_HI(DEF_ALU_R, DEF_ALU_HL, A, alu_xor)
+ROW_LO(DEF_ALU_R, DEF_ALU_HL, B, alu_or)
+ROW_HI(DEF_ALU_R, DEF_ALU_HL, B, alu_cp)
+
+// 0xCX
+DEF_RET_CC(C0, COND_NZ)
+DEF_POP(C1, b, c)
+DEF_JP(C2, COND_NZ)
+DEF_JP(C3, COND_NONE)
+DEF_CALL(C4, COND_NZ)
+DEF_PUSH(C5, b, c)
+DEF_ALU_D8(C6, alu_add)
+DEF_RST(C7, 0x00)
+DEF_RET_CC(C8, COND_Z)
+HANDLER(op_C9) { pop_pc(ctx); }
+DEF_JP(CA, COND_Z)
+DEF_CALL(CC, COND_Z)
+DEF_CALL(CD, COND_NONE)
+DEF_ALU_D8(CE, alu_adc)
+DEF_RST(CF, 0x08)
+
+// 0xDX
+DEF_RET_CC(D0, COND_NC)
+DEF_POP(D1, d, e)
+DEF_JP(D2, COND_NC)
+DEF_CALL(D4, COND_NC)
+DEF_PUSH(D5, d, e)
+DEF_ALU_D8(D6, alu_sub)
+DEF_RST(D7, 0x10)
+DEF_RET_CC(D8, COND_C)
+HANDLER(op_D9) {
+    ctx->interrupt_master_enabled = true;
+    pop_pc(ctx);
+}
+DEF_JP(DA, COND_C)
+DEF_CALL(DC, COND_C)
+DEF_ALU_D8(DE, alu_sbc)
+DEF_RST(DF, 0x18)
+
+// 0xEX
+HANDLER(op_E0) {
+    u16 addr = 0xFF00 | fetch8(ctx);
+    bus_write(GB(ctx), addr, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+}
+DEF_POP(E1, h, l)
+HANDLER(op_E2) {
+    bus_write(GB(ctx), 0xFF00 | ctx->regs.c, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+}
+DEF_PUSH(E5, h, l)
+DEF_ALU_D8(E6, alu_and)
+DEF_RST(E7, 0x20)
+HANDLER(op_E8) {
+    u16 sp = ctx->regs.sp;
+    u8 v = fetch8(ctx);
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.sp = sp + (int8_t)v;
+    cpu_set_f(ctx, FLAGS(0, 0, (sp & 0xF) + (v & 0xF) >= 0x10, (sp & 0xFF) + v >= 0x100));
+}
+HANDLER(op_E9) {
+    ctx->regs.pc = PAIR(h, l);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_EA) {
+    u16 addr = fetch16(ctx);
+    bus_write(GB(ctx), addr, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+}
+DEF_ALU_D8(EE, alu_xor)
+DEF_RST(EF, 0x28)
+
+// 0xFX
+HANDLER(op_F0) {
+    u8 n = fetch8(ctx);
+    ctx->regs.a = bus_read(GB(ctx), 0xFF00 | n);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_F1) {
+    cpu_set_f(ctx, stack_pop(ctx) & 0xF0);
+    emu_cycles(GB(ctx), 1);
+    ctx->regs.a = stack_pop(ctx);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_F2) {
+    ctx->regs.a = bus_read(GB(ctx), 0xFF00 | ctx->regs.c);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_F3) { ctx->interrupt_master_enabled = false; }
+HANDLER(op_F5) {
+    emu_cycles(GB(ctx), 1);
+    stack_push(ctx, ctx->regs.a);
+    emu_cycles(GB(ctx), 1);
+    stack_push(ctx, cpu_get_f(ctx));
+    emu_cycles(GB(ctx), 1);
+}
+DEF_ALU_D8(F6, alu_or)
+DEF_RST(F7, 0x30)
+HANDLER(op_F8) {
+    u16 sp = ctx->regs.sp;
+    u8 v = fetch8(ctx);
+    cpu_set_f(ctx, FLAGS(0, 0, (sp & 0xF) + (v & 0xF) >= 0x10, (sp & 0xFF) + v >= 0x100));
+    SET_PAIR(h, l, sp + (int8_t)v);
+}
+HANDLER(op_F9) { ctx->regs.sp = PAIR(h, l); }
+HANDLER(op_FA) {
+    u16 addr = fetch16(ctx);
+    ctx->regs.a = bus_read(GB(ctx), addr);
+    emu_cycles(GB(ctx), 1);
+}
+HANDLER(op_FB) { ctx->enabling_ime = true; }
+DEF_ALU_D8(FE, alu_cp)
+DEF_RST(FF, 0x38)
+
+// CB 0x00 - 0x3F: rotates, shifts and swap
+ROW_LO(DEF_CB_R, DEF_CB_HL, 0, cb_rlc)
+ROW_HI(DEF_CB_R, DEF_CB_HL, 0, cb_rrc)
+ROW_LO(DEF_CB_R, DEF_CB_HL, 1, cb_rl)
+ROW_HI(DEF_CB_R, DEF_CB_HL, 1, cb_rr)
+ROW_LO(DEF_CB_R, DEF_CB_HL, 2, cb_sla)
+ROW_HI(DEF_CB_R, DEF_CB_HL, 2, cb_sra)
+ROW_LO(DEF_CB_R, DEF_CB_HL, 3, cb_swap)
+ROW_HI(DEF_CB_R, DEF_CB_HL, 3, cb_srl)
+
+// CB 0x40 - 0xFF: BIT, RES, SET
+#define BIT_ROWS(DEF_R, DEF_HL, X0, X1, X2, X3) \
+    ROW_LO(DEF_R, DEF_HL, X0, 0) ROW_HI(DEF_R, DEF_HL, X0, 1) \
+    ROW_LO(DEF_R, DEF_HL, X1, 2) ROW_HI(DEF_R, DEF_HL, X1, 3) \
+    ROW_LO(DEF_R, DEF_HL, X2, 4) ROW_HI(DEF_R, DEF_HL, X2, 5) \
+    ROW_LO(DEF_R, DEF_HL, X3, 6) ROW_HI(DEF_R, DEF_HL, X3, 7)
+
+BIT_ROWS(DEF_BIT_R, DEF_BIT_HL, 4, 5, 6, 7)
+BIT_ROWS(DEF_RES_R, DEF_RES_HL, 8, 9, A, B)
+BIT_ROWS(DEF_SET_R, DEF_SET_HL, C, D, E, F)
+
+// Unused opcodes
+#define op_D3 op_invalid
+#define op_DB op_invalid
+#define op_DD op_invalid
+#define op_E3 op_invalid
+#define op_E4 op_invalid
+#define op_EB op_invalid
+#define op_EC op_invalid
+#define op_ED op_invalid
+#define op_F4 op_invalid
+#define op_FC op_invalid
+#define op_FD op_invalid
+
+// The CB prefix reads the second opcode byte and dispatches to the CB half
+HANDLER(op_CB) {
+    u8 op = fetch8(ctx);
+    op_handlers[0x100 | op](ctx);
+}
+
+// Fused handlers (superinstructions)
+// Each runs a common opcode sequence as one unit. The opcodes picked are the
+// most frequent fall-through sequences in the GBEMU_PROFILE counts plus the
+// usual copy and polling loops. Between opcodes a fused handler does what the
+// block runner does between instructions (run_block in cpu.c), so cycles,
+// serial output and tracing stay exact. Only the last opcode may branch.
+
+// Starts the next opcode of a fused sequence. Returns false, leaving PC at
+// that opcode, if end of instruction handling has work to do (interrupt
+// dispatch or a delayed EI) or cached code changed; the block runner then
+// takes over from there.
+static inline bool fused_next(cpu_context *ctx, u32 gen, u8 opcode) {
+    if (ctx->enabling_ime || gen != GB(ctx)->block.gen ||
+        (ctx->interrupt_master_enabled && ctx->int_pending)) {
+        return false;
+    }
+
+    trace_step(ctx, ctx->regs.pc, opcode, 0);
+    profile_step(GB(ctx), ctx->regs.pc);
+
+    ctx->curr_opcode = opcode;
+    ctx->regs.pc++;
+    emu_cycles(GB(ctx), 1);
+
+    debug_update(GB(ctx));
+    debug_print(GB(ctx));
+
+    return true;
+}
+
+#define FUSED2(a, b) HANDLER(fused_##a##_##b) { \
+    u32 gen = GB(ctx)->block.gen; \
+    op_##a(ctx); \
+    if (fused_next(ctx, gen, 0x##b)) { \
+        op_##b(ctx); \
+    } \
+}
+
+#define FUSED3(a, b, c) HANDLER(fused_##a##_##b##_##c) { \
+    u32 gen = GB(ctx)->block.gen; \
+    op_##a(ctx); \
+    if (!fused_next(ctx, gen, 0x##b)) { \
+        return; \
+    } \
+    op_##b(ctx); \
+    if (fused_next(ctx, gen, 0x##c)) { \
+        op_##c(ctx); \
+    } \
+}
+
+FUSED3(2A, 12, 13) // LD A,(HL+); LD (DE),A; INC DE
+FUSED3(78, B1, 20) // LD A,B; OR C; JR NZ
+FUSED3(F0, FE, 20) // LDH A,(n); CP n; JR NZ
+FUSED3(F0, FE, 28) // LDH A,(n); CP n; JR Z
+FUSED3(F0, AE, 24) // LDH A,(n); XOR (HL); INC H
+FUSED3(7D, FE, 20) // LD A,L; CP n; JR NZ
+FUSED2(05, 20)     // DEC B; JR NZ
+FUSED2(0D, 20)     // DEC C; JR NZ
+FUSED2(FE, 20)     // CP n; JR NZ
+FUSED2(FE, 28)     // CP n; JR Z
+FUSED2(D6, 30)     // SUB n; JR NC
+FUSED2(E0, F0)     // LDH (n),A; LDH A,(n)
+FUSED2(7E, E0)     // LD A,(HL); LDH (n),A
+FUSED2(6F, 26)     // LD L,A; LD H,n
+FUSED2(AD, 6F)     // XOR L; LD L,A
+
+// Longer sequences first, so the block decoder matches them greedily
+const fused_op fused_ops[] = {
+    {{0x2A, 0x12, 0x13}, 3, fused_2A_12_13},
+    {{0x78, 0xB1, 0x20}, 3, fused_78_B1_20},
+    {{0xF0, 0xFE, 0x20}, 3, fused_F0_FE_20},
+    {{0xF0, 0xFE, 0x28}, 3, fused_F0_FE_28},
+    {{0xF0, 0xAE, 0x24}, 3, fused_F0_AE_24},
+    {{0x7D, 0xFE, 0x20}, 3, fused_7D_FE_20},
+    {{0x05, 0x20}, 2, fused_05_20},
+    {{0x0D, 0x20}, 2, fused_0D_20},
+    {{0xFE, 0x20}, 2, fused_FE_20},
+    {{0xFE, 0x28}, 2, fused_FE_28},
+    {{0xD6, 0x30}, 2, fused_D6_30},
+    {{0xE0, 0xF0}, 2, fused_E0_F0},
+    {{0x7E, 0xE0}, 2, fused_7E_E0},
+    {{0x6F, 0x26}, 2, fused_6F_26},
+    {{0xAD, 0x6F}, 2, fused_AD_6F},
+};
+
+const int fused_op_count = sizeof(fused_ops) / sizeof(fused_ops[0]);
+
+// Handler table, one row of 16 opcodes per line
+#define TABLE_ROW(P, X) \
+    P##X##0, P##X##1, P##X##2, P##X##3, P##X##4, P##X##5, P##X##6, P##X##7, \
+    P##X##8, P##X##9, P##X##A, P##X##B, P##X##C, P##X##D, P##X##E, P##X##F
+
+const OP_HANDLER op_handlers[0x200] = {
+    TABLE_ROW(op_, 0), TABLE_ROW(op_, 1), TABLE_ROW(op_, 2), TABLE_ROW(op_, 3),
+    TABLE_ROW(op_, 4), TABLE_ROW(op_, 5), TABLE_ROW(op_, 6), TABLE_ROW(op_, 7),
+    TABLE_ROW(op_, 8), TABLE_ROW(op_, 9), TABLE_ROW(op_, A), TABLE_ROW(op_, B),
+    TABLE_ROW(op_, C), TABLE_ROW(op_, D), TABLE_ROW(op_, E), TABLE_ROW(op_, F),
+
+    TABLE_ROW(cb_, 0), TABLE_ROW(cb_, 1), TABLE_ROW(cb_, 2), TABLE_ROW(cb_, 3),
+    TABLE_ROW(cb_, 4), TABLE_ROW(cb_, 5), TABLE_ROW(cb_, 6), TABLE_ROW(cb_, 7),
+    TABLE_ROW(cb_, 8), TABLE_ROW(cb_, 9), TABLE_ROW(cb_, A), TABLE_ROW(cb_, B),
+    TABLE_ROW(cb_, C), TABLE_ROW(cb_, D), TABLE_ROW(cb_, E), TABLE_ROW(cb_, F),
+};
@@ -1,4 +1,5 @@
-#include <bus.h>
+#include <alu.h>
+#include <gb.h>
 #include <cpu.h>
 #include <emu.h>
 #include <stack.h>
@@ -7,6 +8,9 @@
 
 // Set flags in F register
 void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c) {
+    // Flags that are left unchanged come from the evaluated F
+    cpu_get_f(ctx);
+
     // Set zero flag
     if (z != -1) {
         BIT_SET(ctx->regs.f, 7, z);
@@ -71,13 +75,11 @@ static void proc_cb(cpu_context *ctx) {
     // Get bit operation
     u8 bit_op = (op >> 6) & 0b11;
 
-    // Get register value
-    u8 reg_val = cpu_read_reg8(reg);
-
-    emu_cycles(1);
+    // Get register value, (HL) takes a cycle to read
+    u8 reg_val = cpu_read_reg8(ctx, reg);
 
     if (reg == RT_HL) {
-        emu_cycles(2);
+        emu_cycles(GB(ctx), 1);
     }
 
     switch (bit_op) {
@@ -90,185 +92,76 @@ static void proc_cb(cpu_context *ctx) {
     case 2:
         // This resets the bit to 0
         reg_val &= ~(1 << bit);
-        cpu_set_reg8(reg, reg_val);
-        return;
+        break;
     // SET
     case 3:
         // This sets the bit to 1
         reg_val |= (1 << bit);
-        cpu_set_reg8(reg, reg_val);
-        return;
-    }
-
+        break;
     // RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL operations
-    bool flagC = CPU_FLAG_C;
-
-    switch (bit) {
-    case 0: {
-        // RLC
-        bool setC = false;
-        u8 result = (reg_val << 1) & 0xFF;
-
-        if ((reg_val & (1 << 7)) != 0) {
-            result |= 1;
-            setC = true;
-        }
+    default: {
+        u16 e = alu_shift_table[bit][CPU_FLAG_C][reg_val];
 
-        cpu_set_reg8(reg, result);
-        cpu_set_flags(ctx, result == 0, false, false, setC);
+        reg_val = ALU_RESULT(e);
+        cpu_set_f(ctx, ALU_FLAGS(e));
+    } break;
     }
-        return;
-
-    case 1: {
-        // RRC - Rotate right with carry
-        u8 old = reg_val;
-        reg_val >>= 1;
-        reg_val |= (old << 7);
-
-        cpu_set_reg8(reg, reg_val);
-        cpu_set_flags(ctx, !reg_val, false, false, old & 1);
-    }
-        return;
-
-    // RL - Rotate left
-    case 2: {
-        u8 old = reg_val;
-        reg_val <<= 1;
-        reg_val |= flagC;
 
-        cpu_set_reg8(reg, reg_val);
-        cpu_set_flags(ctx, !reg_val, false, false, !!(old & 0x80));
-    }
-        return;
+    // And another to write it back
+    cpu_set_reg8(ctx, reg, reg_val);
 
-    // RR - Rotate right
-    case 3: {
-        u8 old = reg_val;
-        reg_val >>= 1;
-
-        reg_val |= (flagC << 7);
-
-        cpu_set_reg8(reg, reg_val);
-        cpu_set_flags(ctx, !reg_val, false, false, old & 1);
-    }
-        return;
-
-    // SLA - Shift left arithmetic
-    case 4: {
-        u8 old = reg_val;
-        reg_val <<= 1;
-
-        cpu_set_reg8(reg, reg_val);
-        cpu_set_flags(ctx, !reg_val, false, false, !!(old & 0x80));
-    }
-        return;
-
-    // SRA - Shift right arithmetic
-    case 5: {
-        u8 u = (int8_t)reg_val >> 1;
-        cpu_set_reg8(reg, u);
-        cpu_set_flags(ctx, !u, 0, 0, reg_val & 1);
-    }
-        return;
-
-    // SWAP - Swap nibbles
-    case 6: {
-        reg_val = ((reg_val & 0xF0) >> 4) | ((reg_val & 0xF) << 4);
-        cpu_set_reg8(reg, reg_val);
-        cpu_set_flags(ctx, reg_val == 0, false, false, false);
+    if (reg == RT_HL) {
+        emu_cycles(GB(ctx), 1);
     }
-        return;
+}
 
-    // SRL - Shift right logical
-    case 7: {
-        u8 u = reg_val >> 1;
-        cpu_set_reg8(reg, u);
-        cpu_set_flags(ctx, !u, 0, 0, reg_val & 1);
-    }
-        return;
-    }
+// Rotate A using the CB shift table; unlike the CB forms Z is always cleared
+static void rotate_a(cpu_context *ctx, alu_shift_op op) {
+    u16 e = alu_shift_table[op][CPU_FLAG_C][ctx->regs.a];
 
-    fprintf(stderr, "Unknown CB instruction: %02X\n", op);
-    NO_IMPL
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e) & 0x10);
 }
 
 // Rotate left through carry
 static void proc_rlca(cpu_context *ctx) {
-    u8 u = ctx->regs.a;
-
-    // Calculate if carry should be set
-    bool c = (u >> 7) & 1;
-    u = (u << 1) | c;
-    ctx->regs.a = u;
-
-    cpu_set_flags(ctx, u == 0, 0, 0, c);
+    rotate_a(ctx, ALU_RLC);
 }
 
 // Rotate right through carry
 static void proc_rrca(cpu_context *ctx) {
-    u8 b = ctx->regs.a;
-    ctx->regs.a >>= 1;
-
-    // Shift last to front
-    ctx->regs.a |= (b << 7);
-
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0, 0, b & 1);
+    rotate_a(ctx, ALU_RRC);
 }
 
 // Rotate left
 static void proc_rla(cpu_context *ctx) {
-    u8 u = ctx->regs.a;
-    u8 cf = CPU_FLAG_C;
-    u8 c = (u >> 7) & 1;
-
-    ctx->regs.a = (u << 1) | cf;
-    cpu_set_flags(ctx, 0, 0, 0, c);
-    
+    rotate_a(ctx, ALU_RL);
 }
 
 // Rotate right
 static void proc_rra(cpu_context *ctx) {
-    u8 cf = CPU_FLAG_C;
-
-    // Is first bit set?
-    u8 new_cf = ctx->regs.a & 1;
-
-    ctx->regs.a >>= 1;
-    ctx->regs.a |= (cf << 7);
-
-    cpu_set_flags(ctx, 0, 0, 0, new_cf);
+    rotate_a(ctx, ALU_RR);
 }
 
 // Stop instruction
+// Two bytes long, fetch_data has skipped the second. Low power mode and the
+// CGB speed switch are not emulated, execution just carries on.
 static void proc_stop(cpu_context *ctx) {
-    fprintf(stderr, "STOPPING\n");
-    NO_IMPL
 }
 
-// Decimal adjust accumulator - Don't fully understand this
+// Decimal adjust accumulator
 static void proc_daa(cpu_context *ctx) {
-    u8 u = 0;
-    int cf = 0;
-
-    if (CPU_FLAG_H || (!CPU_FLAG_N && (ctx->regs.a & 0xF) > 9)) {
-        u = 6;
-    }
-
-    if (CPU_FLAG_C || (!CPU_FLAG_N && ctx->regs.a > 0x99)) {
-        u |= 0x60;
-        cf = 1;
-    }
-
-    ctx->regs.a += CPU_FLAG_N ? -u : u;
+    u16 e = alu_daa_table[(CPU_FLAG_N << 2) | (CPU_FLAG_H << 1) | CPU_FLAG_C][ctx->regs.a];
 
-    cpu_set_flags(ctx, ctx->regs.a == 0, -1, 0, cf);
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e));
 }
 
 // Complement accumulator
 static void proc_cpl(cpu_context *ctx) {
     // Negate accumulator and set flags
     ctx->regs.a = ~ctx->regs.a;
-    cpu_set_flags(ctx, 0, 1, 1, -1);
+    cpu_set_flags(ctx, -1, 1, 1, -1);
 }
 
 // Set carry flag
@@ -305,11 +198,9 @@ static void proc_or(cpu_context *ctx) {
     cpu_set_flags(ctx, ctx->regs.a == 0, 0, 0, 0);
 }
 
+// Compare instruction
 static void proc_cp(cpu_context *ctx) {
-    int n = (int)ctx->regs.a - (int)ctx->fetched_data;
-
-    cpu_set_flags(ctx, n == 0, 1,
-                  ((int)ctx->regs.a & 0x0F) - ((int)ctx->fetched_data & 0xF) < 0, n < 0);
+    cpu_set_f(ctx, ALU_FLAGS(alu_sub_table[0][ctx->regs.a][ctx->fetched_data & 0xFF]));
 }
 
 // Check if register is 16-bit
@@ -324,48 +215,48 @@ static void proc_ld(cpu_context *ctx) {
 
         // If 16-bit register
         if (is_16_bit(ctx->curr_instr->reg_2)) {
-            emu_cycles(1);
-            bus_write16(ctx->mem_dest, ctx->fetched_data);
+            emu_cycles(GB(ctx), 1);
+            bus_write16(GB(ctx), ctx->mem_dest, ctx->fetched_data);
         } else {
-            bus_write(ctx->mem_dest, ctx->fetched_data);
+            bus_write(GB(ctx), ctx->mem_dest, ctx->fetched_data);
         }
-        emu_cycles(1);
+        emu_cycles(GB(ctx), 1);
         return;
     }
 
     // Load stack pointer + 8-bit immediate into memory
     if (ctx->curr_instr->mode == AM_HL_SPR) {
         // Check if H flag should be set
-        u8 hflag = (cpu_read_reg(ctx->curr_instr->reg_2) & 0xF) +
+        u8 hflag = (cpu_read_reg(ctx, ctx->curr_instr->reg_2) & 0xF) +
                        (ctx->fetched_data & 0xF) >=
                    0x10;
 
         // Check if C flag should be set
-        u8 cflag = (cpu_read_reg(ctx->curr_instr->reg_2) & 0xFF) +
+        u8 cflag = (cpu_read_reg(ctx, ctx->curr_instr->reg_2) & 0xFF) +
                        (ctx->fetched_data & 0xFF) >=
                    0x100;
 
         cpu_set_flags(ctx, 0, 0, hflag, cflag);
-        cpu_set_reg(ctx->curr_instr->reg_1,
-                    cpu_read_reg(ctx->curr_instr->reg_2) + (char)ctx->fetched_data);
+        cpu_set_reg(ctx, ctx->curr_instr->reg_1,
+                    cpu_read_reg(ctx, ctx->curr_instr->reg_2) + (int8_t)ctx->fetched_data);
 
         return;
     }
 
-    cpu_set_reg(ctx->curr_instr->reg_1, ctx->fetched_data);
+    cpu_set_reg(ctx, ctx->curr_instr->reg_1, ctx->fetched_data);
 }
 
 // Load into hram
 static void proc_ldh(cpu_context *ctx) {
     if (ctx->curr_instr->reg_1 == RT_A) {
         // Set A to value at address hram
-        cpu_set_reg(ctx->curr_instr->reg_1, bus_read(0xFF00 | ctx->fetched_data));
+        cpu_set_reg(ctx, ctx->curr_instr->reg_1, bus_read(GB(ctx), 0xFF00 | ctx->fetched_data));
     } else {
         // Set value at address hram to A
-        bus_write(0xFF00 | ctx->fetched_data, ctx->regs.a);
+        bus_write(GB(ctx), ctx->mem_dest, ctx->regs.a);
     }
 
-    emu_cycles(1);
+    emu_cycles(GB(ctx), 1);
 }
 
 // Check condition of set flags
@@ -394,11 +285,11 @@ static void goto_addr(cpu_context *ctx, u16 addr, bool pushpc) {
     // Check condition used for conditional jumps
     if (check_cond(ctx)) {
         if (pushpc) {
-            emu_cycles(2);
-            stack_push16(ctx->regs.pc);
+            emu_cycles(GB(ctx), 2);
+            stack_push16(ctx, ctx->regs.pc);
         }
         ctx->regs.pc = addr;
-        emu_cycles(1);
+        emu_cycles(GB(ctx), 1);
     }
 }
 
@@ -410,7 +301,7 @@ static void proc_jp(cpu_context *ctx) {
 // Jump relative instruction (add immediate to PC)
 static void proc_jr(cpu_context *ctx) {
     // Relative address could be pos or neg
-    char rel = (char)(ctx->fetched_data & 0xFF);
+    int8_t rel = (int8_t)(ctx->fetched_data & 0xFF);
     u16 addr = ctx->regs.pc + rel;
     goto_addr(ctx, addr, false);
 }
@@ -428,19 +319,19 @@ static void proc_rst(cpu_context *ctx) {
 // Ret instruction (opposite of call)
 static void proc_ret(cpu_context *ctx) {
     if (ctx->curr_instr->cond != CT_NONE) {
-        emu_cycles(1);
+        emu_cycles(GB(ctx), 1);
     }
 
     if (check_cond(ctx)) {
-        u16 lo = stack_pop();
-        emu_cycles(1);
-        u16 hi = stack_pop();
-        emu_cycles(1);
+        u16 lo = stack_pop(ctx);
+        emu_cycles(GB(ctx), 1);
+        u16 hi = stack_pop(ctx);
+        emu_cycles(GB(ctx), 1);
 
         u16 n = (hi << 8) | lo;
         ctx->regs.pc = n;
 
-        emu_cycles(1);
+        emu_cycles(GB(ctx), 1);
     }
 }
 
@@ -452,32 +343,32 @@ static void proc_reti(cpu_context *ctx) {
 
 // Pop from stack
 static void proc_pop(cpu_context *ctx) {
-    u16 lo = stack_pop();
-    emu_cycles(1);
-    u16 hi = stack_pop();
-    emu_cycles(1);
+    u16 lo = stack_pop(ctx);
+    emu_cycles(GB(ctx), 1);
+    u16 hi = stack_pop(ctx);
+    emu_cycles(GB(ctx), 1);
 
     u16 n = (hi << 8) | lo;
 
-    cpu_set_reg(ctx->curr_instr->reg_1, n);
+    cpu_set_reg(ctx, ctx->curr_instr->reg_1, n);
 
     if (ctx->curr_instr->reg_1 == RT_AF) {
         // Mask out lower 4 bits because they are reserved for flags
-        cpu_set_reg(ctx->curr_instr->reg_1, n & 0xFFF0);
+        cpu_set_reg(ctx, ctx->curr_instr->reg_1, n & 0xFFF0);
     }
 }
 
 // Push to stack
 static void proc_push(cpu_context *ctx) {
-    u16 hi = (cpu_read_reg(ctx->curr_instr->reg_1) >> 8) & 0xFF;
-    emu_cycles(1);
-    stack_push(hi);
+    u16 hi = (cpu_read_reg(ctx, ctx->curr_instr->reg_1) >> 8) & 0xFF;
+    emu_cycles(GB(ctx), 1);
+    stack_push(ctx, hi);
 
-    u16 lo = cpu_read_reg(ctx->curr_instr->reg_2) & 0xFF;
-    emu_cycles(1);
-    stack_push(lo);
+    u16 lo = cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xFF;
+    emu_cycles(GB(ctx), 1);
+    stack_push(ctx, lo);
 
-    emu_cycles(1);
+    emu_cycles(GB(ctx), 1);
 }
 
 // Disable interrupts
@@ -492,20 +383,20 @@ static void proc_ei(cpu_context *ctx) {
 
 // Increment register
 static void proc_inc(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->curr_instr->reg_1) + 1;
+    u16 val = cpu_read_reg(ctx, ctx->curr_instr->reg_1) + 1;
 
-    if (is_16_bit(ctx->curr_instr->reg_1)) {
-        emu_cycles(1);
-    }
-
-    // If HL and mode is memory read then we need to first read from memory
-    if (ctx->curr_instr->reg_1 == RT_HL && ctx->curr_instr->mode == AM_MR) {
-        val = bus_read(cpu_read_reg(RT_HL)) + 1;
-        val &= 0xFF;
-        bus_write(cpu_read_reg(RT_HL), val);
+    if (ctx->curr_instr->mode == AM_MR) {
+        // (HL) was read by fetch_data, the write takes another cycle
+        val = (ctx->fetched_data + 1) & 0xFF;
+        bus_write(GB(ctx), ctx->mem_dest, val);
+        emu_cycles(GB(ctx), 1);
     } else {
-        cpu_set_reg(ctx->curr_instr->reg_1, val);
-        val = cpu_read_reg(ctx->curr_instr->reg_1);
+        if (is_16_bit(ctx->curr_instr->reg_1)) {
+            emu_cycles(GB(ctx), 1);
+        }
+
+        cpu_set_reg(ctx, ctx->curr_instr->reg_1, val);
+        val = cpu_read_reg(ctx, ctx->curr_instr->reg_1);
     }
 
     // 0x03 operations don't set flags
@@ -518,19 +409,20 @@ static void proc_inc(cpu_context *ctx) {
 
 // Decrement register
 static void proc_dec(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->curr_instr->reg_1) - 1;
-
-    if (is_16_bit(ctx->curr_instr->reg_1)) {
-        emu_cycles(1);
-    }
+    u16 val = cpu_read_reg(ctx, ctx->curr_instr->reg_1) - 1;
 
-    // If HL and mode is memory read then we need to first read from memory
-    if (ctx->curr_instr->reg_1 == RT_HL && ctx->curr_instr->mode == AM_MR) {
-        val = bus_read(cpu_read_reg(RT_HL)) - 1;
-        bus_write(cpu_read_reg(RT_HL), val);
+    if (ctx->curr_instr->mode == AM_MR) {
+        // (HL) was read by fetch_data, the write takes another cycle
+        val = (ctx->fetched_data - 1) & 0xFF;
+        bus_write(GB(ctx), ctx->mem_dest, val);
+        emu_cycles(GB(ctx), 1);
     } else {
-        cpu_set_reg(ctx->curr_instr->reg_1, val);
-        val = cpu_read_reg(ctx->curr_instr->reg_1);
+        if (is_16_bit(ctx->curr_instr->reg_1)) {
+            emu_cycles(GB(ctx), 1);
+        }
+
+        cpu_set_reg(ctx, ctx->curr_instr->reg_1, val);
+        val = cpu_read_reg(ctx, ctx->curr_instr->reg_1);
     }
 
     // 0x0B operations don't set flags
@@ -543,70 +435,67 @@ static void proc_dec(cpu_context *ctx) {
 
 // Subtract instruction
 static void proc_sub(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->curr_instr->reg_1) - ctx->fetched_data;
-
-    int z = val == 0;
-    int h = ((int)cpu_read_reg(ctx->curr_instr->reg_1) & 0xF) - ((int)ctx->fetched_data & 0xF) < 0;
-    int c = ((int)cpu_read_reg(ctx->curr_instr->reg_1)) - ((int)ctx->fetched_data) < 0;
+    u16 e = alu_sub_table[0][ctx->regs.a][ctx->fetched_data & 0xFF];
 
-    cpu_set_reg(ctx->curr_instr->reg_1, val);
-    cpu_set_flags(ctx, z, 1, h, c);
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e));
 }
 
 // Subtract with carry
 static void proc_sbc(cpu_context *ctx) {
-    u8 val = ctx->fetched_data + CPU_FLAG_C;
+    u16 e = alu_sub_table[CPU_FLAG_C][ctx->regs.a][ctx->fetched_data & 0xFF];
 
-    int z = cpu_read_reg(ctx->curr_instr->reg_1) - val == 0;
-
-    int h = ((int)cpu_read_reg(ctx->curr_instr->reg_1) & 0xF) - ((int)ctx->fetched_data & 0xF) - ((int)CPU_FLAG_C) < 0;
-    int c = ((int)cpu_read_reg(ctx->curr_instr->reg_1)) - ((int)ctx->fetched_data) - ((int)CPU_FLAG_C) < 0;
-
-    cpu_set_reg(ctx->curr_instr->reg_1, cpu_read_reg(ctx->curr_instr->reg_1) - val);
-    cpu_set_flags(ctx, z, 1, h, c);
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e));
 }
 
 // Add with carry
 static void proc_adc(cpu_context *ctx) {
-    u16 u = ctx->fetched_data;
-    u16 a = ctx->regs.a;
-    u16 c = CPU_FLAG_C;
+    u16 e = alu_add_table[CPU_FLAG_C][ctx->regs.a][ctx->fetched_data & 0xFF];
 
-    ctx->regs.a = a + u + c;
-
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0, (a & 0xF) + (u & 0xF) + c > 0xF, a + u + c > 0xFF);
+    ctx->regs.a = ALU_RESULT(e);
+    cpu_set_f(ctx, ALU_FLAGS(e));
 }
 
 // Add instruction
 static void proc_add(cpu_context *ctx) {
+    // 8-bit adds come straight from the ALU table
+    if (ctx->curr_instr->reg_1 == RT_A) {
+        u16 e = alu_add_table[0][ctx->regs.a][ctx->fetched_data & 0xFF];
+
+        ctx->regs.a = ALU_RESULT(e);
+        cpu_set_f(ctx, ALU_FLAGS(e));
+        return;
+    }
+
     // 32-bit because there could be overflow when adding 16-bit values
-    u32 val = cpu_read_reg(ctx->curr_instr->reg_1) + ctx->fetched_data;
+    u32 val = cpu_read_reg(ctx, ctx->curr_instr->reg_1) + ctx->fetched_data;
 
     bool is_16bit = is_16_bit(ctx->curr_instr->reg_1);
 
     if (is_16bit) {
-        emu_cycles(1);
+        emu_cycles(GB(ctx), 1);
     }
 
     // Fetched value could be negative if we are adding to SP
     if (ctx->curr_instr->reg_1 == RT_SP) {
-        val = cpu_read_reg(ctx->curr_instr->reg_1) + (char)ctx->fetched_data;
+        val = cpu_read_reg(ctx, ctx->curr_instr->reg_1) + (int8_t)ctx->fetched_data;
     }
 
     int z = (val & 0xFF) == 0;
     // Half carry if result is greater than a nibble
-    int h = (cpu_read_reg(ctx->curr_instr->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
+    int h = (cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
 
     // Carry if result is greater than a byte
-    int c = (int)(cpu_read_reg(ctx->curr_instr->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
+    int c = (int)(cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
 
     if (is_16bit) {
         // Z unchanged
         z = -1;
 
         // Half carry if result is greater than 3 nibbles
-        h = (cpu_read_reg(ctx->curr_instr->reg_1) & 0xFFF) + (ctx->fetched_data & 0xFFF) >= 0x1000;
-        u32 n = ((u32)cpu_read_reg(ctx->curr_instr->reg_1)) + ((u32)ctx->fetched_data);
+        h = (cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xFFF) + (ctx->fetched_data & 0xFFF) >= 0x1000;
+        u32 n = ((u32)cpu_read_reg(ctx, ctx->curr_instr->reg_1)) + ((u32)ctx->fetched_data);
 
         // Carry if result is greater than 16 bits
         c = n >= 0x10000;
@@ -614,13 +503,13 @@ static void proc_add(cpu_context *ctx) {
 
     if (ctx->curr_instr->reg_1 == RT_SP) {
         z = 0;
-        h = (cpu_read_reg(ctx->curr_instr->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
+        h = (cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
 
         // Carry if 0x100 because we are adding a signed 8-bit value
-        c = (int)(cpu_read_reg(ctx->curr_instr->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
+        c = (int)(cpu_read_reg(ctx, ctx->curr_instr->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
     }
 
-    cpu_set_reg(ctx->curr_instr->reg_1, val & 0xFFFF);
+    cpu_set_reg(ctx, ctx->curr_instr->reg_1, val & 0xFFFF);
     cpu_set_flags(ctx, z, 0, h, c);
 }
 
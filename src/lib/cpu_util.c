@@ -1,111 +1,114 @@
+#include <alu.h>
 #include <cpu.h>
-#include <bus.h>
+#include <gb.h>
 
-extern cpu_context ctx;
+const u8 cpu_reg8_index[RT_L + 1] = {
+    [RT_A] = offsetof(cpu_registers, a),
+    [RT_F] = offsetof(cpu_registers, f),
+    [RT_B] = offsetof(cpu_registers, b),
+    [RT_C] = offsetof(cpu_registers, c),
+    [RT_D] = offsetof(cpu_registers, d),
+    [RT_E] = offsetof(cpu_registers, e),
+    [RT_H] = offsetof(cpu_registers, h),
+    [RT_L] = offsetof(cpu_registers, l),
+};
 
-// Reverse a 16-bit value
-u16 reverse(u16 n) {
-    // e.g. 0x1234 -> 0x3412
-    return ((n & 0xFF00) >> 8) | ((n & 0x00FF) << 8);
+u8 cpu_eval_flags(cpu_context *ctx) {
+    u8 a = ctx->lf_a;
+    u8 b = ctx->lf_b;
+    u8 f = ctx->regs.f;
+
+    // The carry going into ADC/SBC is whatever is left over in the result
+    switch (ctx->lf_op) {
+        case LF_NONE: return f;
+        case LF_ADD: f = ALU_FLAGS(alu_add_table[(ctx->lf_res - a - b) & 1][a][b]); break;
+        case LF_SUB: f = ALU_FLAGS(alu_sub_table[(a - b - ctx->lf_res) & 1][a][b]); break;
+        case LF_AND: f = (((ctx->lf_res & 0xFF) == 0) << 7) | 0x20; break;
+        case LF_LOGIC: f = ((ctx->lf_res & 0xFF) == 0) << 7; break;
+        case LF_INC: f = ALU_FLAGS(alu_inc_table[(u8)(ctx->lf_res - 1)]) | (b << 4); break;
+        case LF_DEC: f = ALU_FLAGS(alu_dec_table[(u8)(ctx->lf_res + 1)]) | (b << 4); break;
+    }
+
+    cpu_set_f(ctx, f);
+    return f;
 }
 
-u16 cpu_read_reg(reg_type rt) {
-    switch(rt) {
-        // 8-bit register cases
-        case RT_A: return ctx.regs.a;
-        case RT_F: return ctx.regs.f;
-        case RT_B: return ctx.regs.b;
-        case RT_C: return ctx.regs.c;
-        case RT_D: return ctx.regs.d;
-        case RT_E: return ctx.regs.e;
-        case RT_H: return ctx.regs.h;
-        case RT_L: return ctx.regs.l;
-
-        // Register pairs reversed because of endianness
-        case RT_AF: return reverse(*((u16 *)&ctx.regs.a));
-        case RT_BC: return reverse(*((u16 *)&ctx.regs.b));
-        case RT_DE: return reverse(*((u16 *)&ctx.regs.d));
-        case RT_HL: return reverse(*((u16 *)&ctx.regs.h));
-
-        case RT_SP: return ctx.regs.sp;
-        case RT_PC: return ctx.regs.pc;
-        default: return 0;
+u16 cpu_read_reg(cpu_context *ctx, reg_type rt) {
+    // F is only up to date once the lazy flags are evaluated
+    if (rt == RT_F || rt == RT_AF) {
+        cpu_get_f(ctx);
+    }
+
+    if (rt >= RT_AF) {
+        return ctx->regs.r16[rt - RT_AF];
     }
+
+    if (rt == RT_NONE) {
+        return 0;
+    }
+
+    return ctx->regs.r8[cpu_reg8_index[rt]];
 }
 
-void cpu_set_reg(reg_type rt, u16 val) {
-    switch(rt) {
-        // 8-bit register cases.
+void cpu_set_reg(cpu_context *ctx, reg_type rt, u16 val) {
+    if (rt == RT_F || rt == RT_AF) {
+        ctx->lf_op = LF_NONE;
+    }
+
+    if (rt >= RT_AF) {
+        ctx->regs.r16[rt - RT_AF] = val;
+    } else if (rt != RT_NONE) {
         // & 0xFF to ensure only 8-bits are set
-        case RT_A: ctx.regs.a = val & 0xFF; break;
-        case RT_F: ctx.regs.f = val & 0xFF; break;
-        case RT_B: ctx.regs.b = val & 0xFF; break;
-        case RT_C: ctx.regs.c = val & 0xFF; break;
-        case RT_D: ctx.regs.d = val & 0xFF; break;
-        case RT_E: ctx.regs.e = val & 0xFF; break;
-        case RT_H: ctx.regs.h = val & 0xFF; break;
-        case RT_L: ctx.regs.l = val & 0xFF; break;
-
-        // Register pairs reversed because of endianness
-        case RT_AF: *((u16 *)&ctx.regs.a) = reverse(val); break;
-        case RT_BC: *((u16 *)&ctx.regs.b) = reverse(val); break;
-        case RT_DE: *((u16 *)&ctx.regs.d) = reverse(val); break;
-        case RT_HL: *((u16 *)&ctx.regs.h) = reverse(val); break;
-
-        case RT_SP: ctx.regs.sp = val; break;
-        case RT_PC: ctx.regs.pc = val; break;
+        ctx->regs.r8[cpu_reg8_index[rt]] = val & 0xFF;
     }
 }
 
-u8 cpu_read_reg8(reg_type rt) {
-    switch (rt) {
-        case RT_A: return ctx.regs.a;
-        case RT_F: return ctx.regs.f;
-        case RT_B: return ctx.regs.b;
-        case RT_C: return ctx.regs.c;
-        case RT_D: return ctx.regs.d;
-        case RT_E: return ctx.regs.e;
-        case RT_H: return ctx.regs.h;
-        case RT_L: return ctx.regs.l;
-        case RT_HL: {
-            // Memory address read
-            return bus_read(cpu_read_reg(RT_HL));
-        }
-        default:
-            printf("Unknown register type: %d\n", rt);
-            NO_IMPL
+u8 cpu_read_reg8(cpu_context *ctx, reg_type rt) {
+    if (rt == RT_HL) {
+        // Memory address read
+        return bus_read(GB(ctx), ctx->regs.hl);
     }
+
+    if (rt == RT_NONE || rt > RT_L) {
+        printf("Unknown register type: %d\n", rt);
+        NO_IMPL
+    }
+
+    if (rt == RT_F) {
+        return cpu_get_f(ctx);
+    }
+
+    return ctx->regs.r8[cpu_reg8_index[rt]];
 }
 
-void cpu_set_reg8(reg_type rt, u8 val) {
-    switch (rt) {
-        case RT_A: ctx.regs.a = val & 0xFF; break;
-        case RT_F: ctx.regs.f = val & 0xFF; break;
-        case RT_B: ctx.regs.b = val & 0xFF; break;
-        case RT_C: ctx.regs.c = val & 0xFF; break;
-        case RT_D: ctx.regs.d = val & 0xFF; break;
-        case RT_E: ctx.regs.e = val & 0xFF; break;
-        case RT_H: ctx.regs.h = val & 0xFF; break;
-        case RT_L: ctx.regs.l = val & 0xFF; break;
-        case RT_HL: {
-            // Memory address write
-            bus_write(cpu_read_reg(RT_HL), val);
-            break;
-        }
-        default:
-            printf("Unknown register type: %d\n", rt);
-            NO_IMPL
+void cpu_set_reg8(cpu_context *ctx, reg_type rt, u8 val) {
+    if (rt == RT_HL) {
+        // Memory address write
+        bus_write(GB(ctx), ctx->regs.hl, val);
+        return;
     }
+
+    if (rt == RT_NONE || rt > RT_L) {
+        printf("Unknown register type: %d\n", rt);
+        NO_IMPL
+    }
+
+    if (rt == RT_F) {
+        ctx->lf_op = LF_NONE;
+    }
+
+    ctx->regs.r8[cpu_reg8_index[rt]] = val;
 }
 
-cpu_registers *cpu_get_regs() {
-    return &ctx.regs;
+cpu_registers *cpu_get_regs(gb_t *gb) {
+    return &gb->cpu.regs;
 }
 
-u8 cpu_get_int_flags() {
-    return ctx.int_flags;
+u8 cpu_get_int_flags(gb_t *gb) {
+    return gb->cpu.int_flags;
 }
 
-void cpu_set_int_flags(u8 value) {
-    ctx.int_flags = value;
+void cpu_set_int_flags(gb_t *gb, u8 value) {
+    gb->cpu.int_flags = value;
+    cpu_update_int_pending(&gb->cpu);
 }
\ No newline at end of file
@@ -1,21 +1,26 @@
-#include <debug.h>
-#include <bus.h>
+#include <gb.h>
 
-static char debug_msg[1024] = {0};
-static int msg_size = 0;
+void debug_update(gb_t *gb) {
+    debug_context *ctx = &gb->debug;
 
-void debug_update() {
-    if (bus_read(0xFF02) == 0x81) {
-        char c = bus_read(0xFF01);
+    if (bus_read(gb, 0xFF02) == 0x81) {
+        char c = bus_read(gb, 0xFF01);
 
-        debug_msg[msg_size++] = c;
+        // Keep the terminator, output past the end is dropped
+        if (ctx->size < sizeof(ctx->msg) - 1) {
+            ctx->msg[ctx->size++] = c;
+        }
 
-        bus_write(0xFF02, 0);
+        bus_write(gb, 0xFF02, 0);
     }
 }
 
-void debug_print() {
-    if (debug_msg[0]) {
-        printf("debug: %s\n", debug_msg);
+void debug_print(gb_t *gb) {
+    debug_context *ctx = &gb->debug;
+
+    // Only print when a new character has arrived
+    if (ctx->size != ctx->printed && !ctx->quiet) {
+        printf("debug: %s\n", ctx->msg);
+        ctx->printed = ctx->size;
     }
 }
\ No newline at end of file
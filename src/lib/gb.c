@@ -0,0 +1,37 @@
+#include <gb.h>
+#include <trace.h>
+#include <string.h>
+
+gb_t *gb_create() {
+    gb_t *gb = aligned_alloc(_Alignof(gb_t), sizeof(gb_t));
+
+    if (!gb) {
+        return NULL;
+    }
+
+    memset(gb, 0, sizeof(gb_t));
+
+    // IO registers first, the components register theirs
+    sched_reset(gb);
+    io_init(gb);
+    ram_init(gb);
+    timer_init(gb);
+    cpu_init(gb);
+
+    // Every instance gets its own trace decoder (GBEMU_TRACE builds only)
+    trace_init(gb);
+
+    return gb;
+}
+
+void gb_destroy(gb_t *gb) {
+    if (!gb) {
+        return;
+    }
+
+    aot_unload(gb);
+    cart_unload(gb);
+    jit_free(gb);
+    trace_free(gb);
+    free(gb);
+}
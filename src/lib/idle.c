@@ -0,0 +1,237 @@
+#include <gb.h>
+#include <interrupts.h>
+#include <sha1.h>
+#include <string.h>
+#include <strings.h>
+
+// Time-based reads of a fixed address
+static u8 addr_reads(u16 address) {
+    switch (address) {
+        case 0xFF04: return IDLE_READS_DIV;
+        case 0xFF05: return IDLE_READS_TIMA;
+        case 0xFF0F: return IDLE_READS_IF;
+        default: return 0;
+    }
+}
+
+// Returns the reads made by the instruction at pc, or -1 if it writes
+// memory or changes anything but registers and flags
+static int instr_reads(gb_t *gb, u16 pc) {
+    u8 op = bus_read(gb, pc);
+
+    switch (op) {
+        // LD A,(BC), LD A,(DE), LD A,(HL+), LD A,(HL-), LDH A,(C)
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A: case 0xF2:
+            return IDLE_READS_ANY;
+
+        // LDH A,(n), LD A,(a16)
+        case 0xF0: return addr_reads(0xFF00 | bus_read(gb, pc + 1));
+        case 0xFA: return addr_reads(bus_read16(gb, pc + 1));
+
+        // CB operations on registers, or BIT n,(HL)
+        case 0xCB: {
+            u8 cb = bus_read(gb, pc + 1);
+
+            if ((cb & 7) != 6) {
+                return 0;
+            }
+
+            return (cb & 0xC0) == 0x40 ? IDLE_READS_ANY : -1;
+        }
+
+        // NOP, LD rr,d16, INC/DEC rr, ADD HL,rr, rotates, DAA, CPL, SCF, CCF
+        case 0x00: case 0x01: case 0x11: case 0x21: case 0x31:
+        case 0x03: case 0x13: case 0x23: case 0x33:
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+        case 0x09: case 0x19: case 0x29: case 0x39:
+        case 0x07: case 0x0F: case 0x17: case 0x1F:
+        case 0x27: case 0x2F: case 0x37: case 0x3F:
+        // ALU A,n, LD HL,SP+n, LD SP,HL
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        case 0xF8: case 0xF9:
+            return 0;
+    }
+
+    // INC r, DEC r, LD r,d8 (not (HL))
+    if (op < 0x40 && (op & 7) >= 4 && (op & 7) <= 6) {
+        return ((op >> 3) & 7) == 6 ? -1 : 0;
+    }
+
+    // LD r,r' and ALU A,r (LD (HL),r and HALT write or stop)
+    if (op >= 0x40 && op < 0xC0) {
+        if (op >= 0x70 && op < 0x78) {
+            return -1;
+        }
+
+        return (op & 7) == 6 ? IDLE_READS_ANY : 0;
+    }
+
+    return -1;
+}
+
+// Returns the target of the jump at pc, or -1 if it is not a jump
+static int jump_target(gb_t *gb, u16 pc, u16 next_pc) {
+    u8 op = bus_read(gb, pc);
+
+    switch (op) {
+        // JR e, JR cc,e
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            return (u16)(next_pc + (int8_t)bus_read(gb, pc + 1));
+
+        // JP a16, JP cc,a16
+        case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+            return bus_read16(gb, pc + 1);
+
+        default:
+            return -1;
+    }
+}
+
+u8 idle_analyze(gb_t *gb, code_block *b) {
+    idle_context *ctx = &gb->idle;
+
+    for (int i = 0; i < ctx->num_listed; i++) {
+        if (ctx->listed[i].pc == b->pc && ctx->listed[i].bank == b->bank) {
+            return IDLE_LOOP | IDLE_LISTED | IDLE_READS_ANY;
+        }
+    }
+
+    u8 flags = IDLE_LOOP;
+    u16 pc = b->pc;
+
+    for (int i = 0; i < b->count - 1; i++) {
+        int reads = instr_reads(gb, pc);
+
+        if (reads < 0) {
+            return 0;
+        }
+
+        flags |= reads;
+        pc = b->instrs[i].next_pc;
+    }
+
+    // The block must end by branching back to its own start
+    if (jump_target(gb, pc, b->instrs[b->count - 1].next_pc) != b->pc) {
+        return 0;
+    }
+
+    return flags;
+}
+
+// Returns the number of ticks until something the loop reads could change
+static u32 next_event(gb_t *gb, u8 flags) {
+    u32 ticks = TICKS_PER_FRAME;
+    u32 t;
+
+    if ((flags & IDLE_READS_DIV) && (t = timer_ticks_to_div(gb)) < ticks) {
+        ticks = t;
+    }
+
+    if ((flags & IDLE_READS_TIMA) && (t = timer_ticks_to_tima(gb)) && t < ticks) {
+        ticks = t;
+    }
+
+    // The timer is the only interrupt source that advances with the clock
+    bool timer_irq = gb->cpu.interrupt_master_enabled && (gb->cpu.ie_register & INT_TIMER);
+
+    if (((flags & IDLE_READS_IF) || timer_irq) && (t = timer_ticks_to_overflow(gb)) && t < ticks) {
+        ticks = t;
+    }
+
+    return ticks;
+}
+
+void idle_check(gb_t *gb, code_block *b) {
+    idle_context *ctx = &gb->idle;
+    cpu_context *cpu = &gb->cpu;
+    u64 now = gb->emu.ticks;
+
+    // Compare complete register states
+    cpu_get_f(cpu);
+
+    bool steady = ctx->last.block == b && ctx->last.pc == b->pc && ctx->last.bank == b->bank &&
+        !cpu->enabling_ime && !memcmp(&ctx->last.regs, &cpu->regs, sizeof(cpu_registers));
+
+    // An event after the last iteration's reads is only seen by the next one
+    if (now >= ctx->last.event) {
+        steady = false;
+    }
+
+    // Detected loops must have come straight back; listed ones are trusted
+    // even if other code (such as an interrupt handler) ran in between
+    if (!(b->idle & IDLE_LISTED) && ctx->prev_block != b) {
+        steady = false;
+    }
+
+    u64 event = now + next_event(gb, b->idle);
+
+    if (steady) {
+        // Skip the iterations that would end before the next event
+        u64 iteration = now - ctx->last.ticks;
+        u64 skip = (event - now - 1) / iteration * iteration;
+
+        if (skip) {
+            emu_skip(gb, skip);
+            ctx->skipped_ticks += skip;
+            now += skip;
+        }
+    }
+
+    ctx->last.block = b;
+    ctx->last.pc = b->pc;
+    ctx->last.bank = b->bank;
+    ctx->last.regs = cpu->regs;
+    ctx->last.ticks = now;
+    ctx->last.event = event;
+}
+
+bool idle_load(gb_t *gb, const char *path) {
+    idle_context *ctx = &gb->idle;
+
+    ctx->num_listed = 0;
+
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        return false;
+    }
+
+    char sha[41];
+    char line[1024];
+    char *save;
+
+    sha1_hex(cart_rom_data(gb), cart_rom_size(gb), sha);
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tok = strtok_r(line, " \t\r\n", &save);
+
+        if (!tok || tok[0] == '#' || strcasecmp(tok, sha)) {
+            continue;
+        }
+
+        while ((tok = strtok_r(NULL, " \t\r\n", &save)) && ctx->num_listed < IDLE_MAX_LISTED) {
+            unsigned int bank, pc;
+
+            if (sscanf(tok, "%x:%x", &bank, &pc) == 2) {
+                ctx->listed[ctx->num_listed++] = (idle_addr){bank, pc};
+            }
+        }
+    }
+
+    fclose(f);
+
+    if (ctx->num_listed) {
+        printf("Idle loops: %d listed for this ROM\n", ctx->num_listed);
+    }
+
+    return ctx->num_listed > 0;
+}
+
+void idle_reset(gb_t *gb) {
+    idle_context *ctx = &gb->idle;
+
+    ctx->num_listed = 0;
+    memset(&ctx->last, 0, sizeof(ctx->last));
+    ctx->prev_block = NULL;
+}
@@ -44,7 +44,7 @@ instruction instructions[0x100] = {
     [0x0F] = {IN_RRCA},
 
     //0x1X
-    [0x10] = {IN_STOP},
+    [0x10] = {IN_STOP, AM_D8},
     [0x11] = {IN_LD, AM_R_D16, RT_DE},
     [0x12] = {IN_LD, AM_MR_R, RT_DE, RT_A},
     [0x13] = {IN_INC, AM_R, RT_DE},
@@ -309,6 +309,28 @@ instruction *instruction_by_opcode(u8 opcode) {
     return &instructions[opcode];
 }
 
+u8 instr_length(instruction *instr) {
+    switch (instr->mode) {
+        case AM_R_D16:
+        case AM_D16:
+        case AM_A16_R:
+        case AM_D16_R:
+        case AM_R_A16:
+            return 3;
+
+        case AM_R_D8:
+        case AM_R_A8:
+        case AM_A8_R:
+        case AM_HL_SPR:
+        case AM_D8:
+        case AM_MR_D8:
+            return 2;
+
+        default:
+            return 1;
+    }
+}
+
 // Lookup table for instruction names
 char *inst_lookup[] = {
     "<NONE>",
@@ -452,7 +474,7 @@ void instr_to_str(cpu_context *ctx, char *str) {
 
         case AM_A8_R:
             sprintf(str, "%s $%02X,%s", inst_name(instr->type), 
-                bus_read(ctx->regs.pc - 1), rt_lookup[instr->reg_2]);
+                ctx->mem_dest & 0xFF, rt_lookup[instr->reg_2]);
 
             return;
 
@@ -1,40 +1,34 @@
-#include <cpu.h>
+#include <gb.h>
 #include <stack.h>
 #include <interrupts.h>
 
+// Handler addresses, indexed by interrupt bit
+static const u16 int_vectors[5] = {0x40, 0x48, 0x50, 0x58, 0x60};
+
 // Handles a specific interrupt
 void interrupt_handle(cpu_context *ctx, u16 addr) {
     // Push the current PC onto the stack
-    stack_push16(ctx->regs.pc);
+    stack_push16(ctx, ctx->regs.pc);
 
     // Jump to the interrupt handler
     ctx->regs.pc = addr;
 }
 
-// Checks if an interrupt is enabled and requested
-bool int_check(cpu_context *ctx, u16 address, interrupt_type it) {
-    if (ctx->int_flags & it && ctx->ie_register & it) {
-        interrupt_handle(ctx, address);
-        ctx->int_flags &= ~it;
-        ctx->halted = false;
-        ctx->interrupt_master_enabled = false;
-
-        return true;
-    }
-
-    return false;
-}
-
 void cpu_handle_interrupts(cpu_context *ctx) {
-    if (int_check(ctx, 0x40, INT_VBLANK)) {
-
-    } else if (int_check(ctx, 0x48, INT_LCD_STAT)) {
+    if (!ctx->int_pending) {
+        return;
+    }
 
-    } else if (int_check(ctx, 0x50, INT_TIMER)) {
+    // The lowest bit has the highest priority (VBlank first)
+    int bit = __builtin_ctz(ctx->int_pending);
 
-    }  else if (int_check(ctx, 0x58, INT_SERIAL)) {
+    ctx->int_flags &= ~(1 << bit);
+    cpu_update_int_pending(ctx);
+    ctx->halted = false;
+    ctx->interrupt_master_enabled = false;
 
-    }  else if (int_check(ctx, 0x60, INT_JOYPAD)) {
+    interrupt_handle(ctx, int_vectors[bit]);
 
-    } 
-}
\ No newline at end of file
+    // Dispatch takes 5 M-cycles: two wait states, the PC push and the jump
+    emu_cycles(GB(ctx), 5);
+}
@@ -1,50 +1,65 @@
-#include <io.h>
-#include <timer.h>
-#include <interrupts.h>
+#include <gb.h>
 
-static char serial_data[2];
+static u8 serial_read(gb_t *gb, u16 address) {
+    return gb->io.serial_data[address - 0xFF01];
+}
 
-u8 io_read(u16 address) {
-    if (address == 0xFF01) {
-        return serial_data[0];
-    }
+static void serial_write(gb_t *gb, u16 address, u8 value) {
+    gb->io.serial_data[address - 0xFF01] = value;
+}
 
-    if (address == 0xFF02) {
-        return serial_data[1];
-    }
+static u8 unsupported_read(gb_t *gb, u16 address) {
+    printf("Unsupported bus_read(0x%04X)\n", address);
+    return 0;
+}
 
-    if (BETWEEN(address, 0xFF04, 0xFF07)) {
-        return timer_read(address);
-    }
+static void unsupported_write(gb_t *gb, u16 address, u8 value) {
+    printf("Unsupported bus_write(0x%04X, 0x%02X)\n", address, value);
+}
 
-    if (address == 0xFF0F) {
-        return cpu_get_int_flags();
+void io_init(gb_t *gb) {
+    io_register(gb, 0xFF00, 0x80, NULL, NULL, 0);
+    io_register(gb, 0xFF01, 2, serial_read, serial_write, 0);
+}
+
+void io_register(gb_t *gb, u16 address, u16 count, IO_READ read, IO_WRITE write, u8 unused) {
+    io_reg *regs = gb->io.regs;
+
+    for (u16 i = address - 0xFF00; i < address - 0xFF00 + count; i++) {
+        regs[i].read = read ? read : unsupported_read;
+        regs[i].write = write ? write : unsupported_write;
+        regs[i].unused = unused;
     }
+}
 
-    printf("Unsupported bus_read(0x%04X)\n", address);
-    return 0;
+u8 io_read(gb_t *gb, u16 address) {
+    io_reg *reg = &gb->io.regs[address & 0x7F];
+
+#ifdef GBEMU_PROFILE
+    reg->reads++;
+#endif
+
+    return reg->read(gb, address) | reg->unused;
 }
 
-void io_write(u16 address, u8 value) {
-    if (address == 0xFF01) {
-        serial_data[0] = value;
-        return;
-    }
+void io_write(gb_t *gb, u16 address, u8 value) {
+    io_reg *reg = &gb->io.regs[address & 0x7F];
 
-    if (address == 0xFF02) {
-        serial_data[1] = value;
-        return;
-    }
-    
-    if (BETWEEN(address, 0xFF04, 0xFF07)) {
-        timer_write(address, value);
-    }
+#ifdef GBEMU_PROFILE
+    reg->writes++;
+#endif
 
-    if (address == 0xFF0F) {
-        cpu_set_int_flags(value);
-        return;
-    }
+    reg->write(gb, address, value);
+}
 
+#ifdef GBEMU_PROFILE
 
-    printf("Unsupported bus_write(0x%04X, 0x%02X)\n", address, value);
-}
\ No newline at end of file
+u64 io_read_count(gb_t *gb, u16 address) {
+    return gb->io.regs[address & 0x7F].reads;
+}
+
+u64 io_write_count(gb_t *gb, u16 address) {
+    return gb->io.regs[address & 0x7F].writes;
+}
+
+#endif
@@ -0,0 +1,408 @@
+#include <gb.h>
+
+#ifdef GBEMU_JIT
+
+#include <interrupts.h>
+#include <trace.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Size of the code buffer
+#define JIT_BUFFER_SIZE (16 << 20)
+
+// Worst case size of a translated block
+#define JIT_MAX_BLOCK_SIZE (BLOCK_MAX_INSTRS * 512)
+
+// Offset of a field in the CPU context
+#define OFF(field) ((u32)offsetof(cpu_context, field))
+
+// Offsets of the 8-bit registers in opcode order (B, C, D, E, H, L, (HL), A)
+static const u32 reg_offsets[8] = {
+    OFF(regs.b), OFF(regs.c), OFF(regs.d), OFF(regs.e),
+    OFF(regs.h), OFF(regs.l), 0, OFF(regs.a)
+};
+
+// Offsets of the 16-bit registers in opcode order (BC, DE, HL, SP)
+static const u32 pair_offsets[4] = {
+    OFF(regs.bc), OFF(regs.de), OFF(regs.hl), OFF(regs.sp)
+};
+
+static void emit8(jit_context *j, u8 v) {
+    *j->code++ = v;
+}
+
+static void emit16(jit_context *j, u16 v) {
+    emit8(j, v & 0xFF);
+    emit8(j, v >> 8);
+}
+
+static void emit32(jit_context *j, u32 v) {
+    emit16(j, v & 0xFFFF);
+    emit16(j, v >> 16);
+}
+
+static void emit64(jit_context *j, u64 v) {
+    emit32(j, v & 0xFFFFFFFF);
+    emit32(j, v >> 32);
+}
+
+// op [rbx + disp32] with the given opcode and ModRM reg field
+static void emit_mem(jit_context *j, u8 op, u8 reg, u32 disp) {
+    emit8(j, op);
+    emit8(j, 0x83 | (reg << 3));
+    emit32(j, disp);
+}
+
+// mov byte [rbx + disp32], imm8
+static void emit_store8(jit_context *j, u32 disp, u8 v) {
+    emit_mem(j, 0xC6, 0, disp);
+    emit8(j, v);
+}
+
+// mov word [rbx + disp32], imm16
+static void emit_store16(jit_context *j, u32 disp, u16 v) {
+    emit8(j, 0x66);
+    emit_mem(j, 0xC7, 0, disp);
+    emit16(j, v);
+}
+
+// cmp byte [rbx + disp32], imm8
+static void emit_cmp8(jit_context *j, u32 disp, u8 v) {
+    emit_mem(j, 0x80, 7, disp);
+    emit8(j, v);
+}
+
+// Calls fn, rdi/esi must already hold the arguments
+static void emit_call(jit_context *j, void *fn) {
+    // mov rax, imm64; call rax
+    emit8(j, 0x48);
+    emit8(j, 0xB8);
+    emit64(j, (u64)fn);
+    emit8(j, 0xFF);
+    emit8(j, 0xD0);
+}
+
+// mov rdi, rbx
+static void emit_ctx_arg(jit_context *j) {
+    emit8(j, 0x48);
+    emit8(j, 0x89);
+    emit8(j, 0xDF);
+}
+
+static void emit_cycles(jit_context *j, u8 n) {
+    emit_ctx_arg(j);
+    // mov esi, imm32
+    emit8(j, 0xBE);
+    emit32(j, n);
+    emit_call(j, emu_cycles);
+}
+
+// jcc rel32 (cc is the low nibble of 0F 8x), returns the offset to patch
+static u8 *emit_jcc(jit_context *j, u8 cc) {
+    emit8(j, 0x0F);
+    emit8(j, 0x80 | cc);
+    emit32(j, 0);
+    return j->code - 4;
+}
+
+// jmp rel32, returns the offset to patch
+static u8 *emit_jmp(jit_context *j) {
+    emit8(j, 0xE9);
+    emit32(j, 0);
+    return j->code - 4;
+}
+
+// Points a rel32 at the current position
+static void patch(jit_context *j, u8 *rel) {
+    *(u32 *)rel = (u32)(j->code - (rel + 4));
+}
+
+// Evaluates lazy flags (cpu_eval_flags) if regs.f is not up to date
+static void emit_eval_flags(jit_context *j) {
+    emit_cmp8(j, OFF(lf_op), LF_NONE);
+    u8 *done = emit_jcc(j, 0x4);
+    emit_ctx_arg(j);
+    emit_call(j, cpu_eval_flags);
+    patch(j, done);
+}
+
+// INC r / DEC r, flags: Z 0/1 H -
+static void emit_inc_dec(jit_context *j, u32 r, bool dec) {
+    u32 f = OFF(regs.f);
+
+    // The carry is kept, so F has to be current
+    emit_eval_flags(j);
+
+    emit_mem(j, 0x8A, 0, r);              // mov al, [r]
+    emit8(j, dec ? 0x2C : 0x04);          // sub/add al, 1
+    emit8(j, 0x01);
+    emit_mem(j, 0x88, 0, r);              // mov [r], al
+    emit8(j, 0x0F); emit8(j, 0x94);       // sete cl
+    emit8(j, 0xC1);
+    emit8(j, 0xC0); emit8(j, 0xE1);       // shl cl, 7
+    emit8(j, 7);
+    emit_mem(j, 0x8A, 2, f);              // mov dl, [f]
+    emit8(j, 0x80); emit8(j, 0xE2);       // and dl, 0x10
+    emit8(j, 0x10);
+    emit8(j, 0x08); emit8(j, 0xCA);       // or dl, cl
+
+    if (dec) {
+        emit8(j, 0x80); emit8(j, 0xCA);   // or dl, 0x40
+        emit8(j, 0x40);
+    }
+
+    emit8(j, 0x88); emit8(j, 0xC1);       // mov cl, al
+    emit8(j, 0x80); emit8(j, 0xE1);       // and cl, 0x0F
+    emit8(j, 0x0F);
+    emit8(j, 0x80); emit8(j, 0xF9);       // cmp cl, 0x0F / 0x00
+    emit8(j, dec ? 0x0F : 0x00);
+    emit8(j, 0x0F); emit8(j, 0x94);       // sete cl
+    emit8(j, 0xC1);
+    emit8(j, 0xC0); emit8(j, 0xE1);       // shl cl, 5
+    emit8(j, 5);
+    emit8(j, 0x08); emit8(j, 0xCA);       // or dl, cl
+    emit_mem(j, 0x88, 2, f);              // mov [f], dl
+}
+
+#ifdef GBEMU_TRACE
+// Operand bytes of the instruction at pc, for the trace record
+static u16 trace_operands(gb_t *gb, u16 pc, u16 next_pc) {
+    u16 len = next_pc - pc;
+
+    return (len > 1 ? bus_read(gb, pc + 1) : 0) | (len > 2 ? bus_read(gb, pc + 2) << 8 : 0);
+}
+#endif
+
+// Emits native code for simple instructions.
+// Returns false if the instruction must go through its handler.
+static bool emit_native(gb_t *gb, u8 op, u16 pc, u16 next_pc) {
+    jit_context *j = &gb->jit;
+    u8 n = bus_read(gb, pc + 1);
+    u16 nn = n | (bus_read(gb, pc + 2) << 8);
+    u8 dst = (op >> 3) & 7;
+    u8 src = op & 7;
+
+    if (op == 0x00) {
+        // NOP
+    } else if (op >= 0x40 && op < 0x80 && op != 0x76 && dst != 6 && src != 6) {
+        // LD r, r
+        emit_mem(j, 0x8A, 0, reg_offsets[src]);
+        emit_mem(j, 0x88, 0, reg_offsets[dst]);
+    } else if ((op & 0xC7) == 0x06 && dst != 6) {
+        // LD r, d8
+        emit_cycles(j, 1);
+        emit_store8(j, reg_offsets[dst], n);
+    } else if ((op & 0xCF) == 0x01) {
+        // LD rr, d16
+        emit_cycles(j, 2);
+        emit_store16(j, pair_offsets[op >> 4], nn);
+    } else if ((op & 0xC7) == 0x04 && dst != 6) {
+        emit_inc_dec(j, reg_offsets[dst], false);
+    } else if ((op & 0xC7) == 0x05 && dst != 6) {
+        emit_inc_dec(j, reg_offsets[dst], true);
+    } else if (op == 0xAF) {
+        // XOR A
+        emit_store8(j, OFF(regs.a), 0);
+        emit_store8(j, OFF(regs.f), 0x80);
+        emit_store8(j, OFF(lf_op), LF_NONE);
+    } else if (op == 0x18) {
+        // JR e
+        emit_cycles(j, 2);
+        next_pc += (int8_t)n;
+    } else if (op == 0xC3) {
+        // JP a16
+        emit_cycles(j, 3);
+        next_pc = nn;
+    } else if ((op & 0xE7) == 0x20) {
+        // JR cc, e: test the flag and skip the branch if the condition fails
+        emit_cycles(j, 1);
+        emit_eval_flags(j);
+        emit_mem(j, 0xF6, 0, OFF(regs.f));
+        emit8(j, op & 0x10 ? 0x10 : 0x80);
+        u8 *skip = emit_jcc(j, op & 0x08 ? 0x4 : 0x5);
+        emit_cycles(j, 1);
+        emit_store16(j, OFF(regs.pc), next_pc + (int8_t)n);
+        u8 *done = emit_jmp(j);
+        patch(j, skip);
+        emit_store16(j, OFF(regs.pc), next_pc);
+        patch(j, done);
+        return true;
+    } else {
+        return false;
+    }
+
+    emit_store16(j, OFF(regs.pc), next_pc);
+    return true;
+}
+
+// Emits the end of instruction interrupt check (see end_instruction in cpu.c).
+// Jumps to the block exit if an interrupt was dispatched.
+static u8 *emit_end_instruction(jit_context *j) {
+    emit_cmp8(j, OFF(interrupt_master_enabled), 0);
+    u8 *no_ime = emit_jcc(j, 0x4);
+
+    // Any interrupt both requested and enabled?
+    emit_cmp8(j, OFF(int_pending), 0);
+    u8 *none = emit_jcc(j, 0x4);
+
+    emit_ctx_arg(j);
+    emit_call(j, cpu_handle_interrupts);
+    emit_store8(j, OFF(enabling_ime), 0);
+    u8 *exit = emit_jmp(j);
+
+    patch(j, none);
+    emit_store8(j, OFF(enabling_ime), 0);
+    patch(j, no_ime);
+
+    emit_cmp8(j, OFF(enabling_ime), 0);
+    u8 *done = emit_jcc(j, 0x4);
+    emit_store8(j, OFF(interrupt_master_enabled), 1);
+    patch(j, done);
+
+    return exit;
+}
+
+// Allocates the code buffer. No page is ever writable and executable at
+// once: jit_compile makes the pages it emits into executable when done.
+static bool jit_init(jit_context *j) {
+    j->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (j->buffer == MAP_FAILED) {
+        fprintf(stderr, "JIT: failed to allocate code buffer, using the interpreter\n");
+        j->buffer = NULL;
+        j->failed = true;
+        return false;
+    }
+
+    j->code = j->buffer;
+    return true;
+}
+
+// Changes the protection of the pages a block emitted at code can occupy.
+// Failing to, the instance falls back to the interpreter.
+static bool jit_protect(gb_t *gb, u8 *code, int prot) {
+    jit_context *j = &gb->jit;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    u8 *start = (u8 *)((uintptr_t)code & ~(page - 1));
+    u8 *end = (u8 *)(((uintptr_t)code + JIT_MAX_BLOCK_SIZE + page - 1) & ~(page - 1));
+
+    if (end > j->buffer + JIT_BUFFER_SIZE) {
+        end = j->buffer + JIT_BUFFER_SIZE;
+    }
+
+    if (mprotect(start, end - start, prot)) {
+        fprintf(stderr, "JIT: failed to protect the code buffer, using the interpreter\n");
+        j->failed = true;
+
+        // Code already in those pages may no longer be executable
+        block_drop_native(gb);
+        return false;
+    }
+
+    return true;
+}
+
+bool jit_compile(gb_t *gb, code_block *b) {
+    jit_context *j = &gb->jit;
+
+    if (j->failed || (!j->buffer && !jit_init(j))) {
+        return false;
+    }
+
+    // Start over when the buffer is full
+    if (j->code + JIT_MAX_BLOCK_SIZE > j->buffer + JIT_BUFFER_SIZE) {
+        block_drop_native(gb);
+        j->code = j->buffer;
+    }
+
+    if (!jit_protect(gb, j->code, PROT_READ | PROT_WRITE)) {
+        return false;
+    }
+
+    u8 *start = j->code;
+    u8 *exits[BLOCK_MAX_INSTRS * 2];
+    int num_exits = 0;
+    u16 pc = b->pc;
+
+    // push rbx; push r12; push r13
+    emit8(j, 0x53);
+    emit8(j, 0x41); emit8(j, 0x54);
+    emit8(j, 0x41); emit8(j, 0x55);
+    // mov rbx, rdi (ctx)
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xFB);
+    // mov r13, &block.gen; mov r12d, [r13]
+    emit8(j, 0x49); emit8(j, 0xBD);
+    emit64(j, (u64)&gb->block.gen);
+    emit8(j, 0x45); emit8(j, 0x8B); emit8(j, 0x65); emit8(j, 0x00);
+
+    for (int i = 0; i < b->count; i++) {
+        block_instr *in = &b->instrs[i];
+
+#ifdef GBEMU_TRACE
+        emit_ctx_arg(j);
+        emit8(j, 0xBE); // mov esi, imm32
+        emit32(j, pc);
+        emit8(j, 0xBA); // mov edx, imm32
+        emit32(j, in->opcode);
+        emit8(j, 0xB9); // mov ecx, imm32
+        emit32(j, trace_operands(gb, pc, in->next_pc));
+        emit_call(j, trace_step);
+#endif
+
+        // Opcode fetch
+        emit_cycles(j, 1);
+        emit_ctx_arg(j);
+        emit_call(j, debug_update);
+        emit_ctx_arg(j);
+        emit_call(j, debug_print);
+
+        if (!emit_native(gb, in->opcode, pc, in->next_pc)) {
+            emit_store16(j, OFF(regs.pc), pc + 1);
+            emit_ctx_arg(j);
+            emit_call(j, op_handlers[in->opcode]);
+        }
+
+        exits[num_exits++] = emit_end_instruction(j);
+
+        // Leave if the instruction changed cached code or banks
+        if (i + 1 < b->count) {
+            // cmp [r13], r12d; jne exit
+            emit8(j, 0x45); emit8(j, 0x39); emit8(j, 0x65); emit8(j, 0x00);
+            exits[num_exits++] = emit_jcc(j, 0x5);
+        }
+
+        pc = in->next_pc;
+    }
+
+    for (int i = 0; i < num_exits; i++) {
+        patch(j, exits[i]);
+    }
+
+    // pop r13; pop r12; pop rbx; ret
+    emit8(j, 0x41); emit8(j, 0x5D);
+    emit8(j, 0x41); emit8(j, 0x5C);
+    emit8(j, 0x5B);
+    emit8(j, 0xC3);
+
+    // Back to executable before anything runs
+    if (!jit_protect(gb, start, PROT_READ | PROT_EXEC)) {
+        return false;
+    }
+
+    b->native = (BLOCK_NATIVE)start;
+    return true;
+}
+
+void jit_free(gb_t *gb) {
+    jit_context *j = &gb->jit;
+
+    if (j->buffer) {
+        munmap(j->buffer, JIT_BUFFER_SIZE);
+    }
+
+    j->buffer = NULL;
+    j->code = NULL;
+}
+
+#endif
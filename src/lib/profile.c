@@ -0,0 +1,144 @@
+#include <profile.h>
+
+#ifdef GBEMU_PROFILE
+
+#include <gb.h>
+#include <instructions.h>
+#include <string.h>
+
+// Opcodes are 0x000 - 0x1FF, with CB-prefixed opcodes at 0x100 | op
+
+static u64 pairs[0x200][0x200];
+
+// Triples are sparse, so they live in an open addressing hash table
+#define TRIPLE_SLOTS (1 << 16)
+
+typedef struct {
+    u32 key; // 1 + (a << 18 | b << 9 | c), 0 if the slot is empty
+    u64 count;
+} triple_slot;
+
+static triple_slot triples[TRIPLE_SLOTS];
+
+// The last two opcodes, and how many of them fell through into the next one
+static u16 prev[2];
+static int run = 0;
+static u32 expected_pc = 0x10000;
+
+static void count_triple(u32 key) {
+    u32 i = (key * 2654435761u) >> 16;
+
+    for (u32 n = 0; n < TRIPLE_SLOTS; n++, i = (i + 1) & (TRIPLE_SLOTS - 1)) {
+        if (triples[i].key == key || !triples[i].key) {
+            triples[i].key = key;
+            triples[i].count++;
+            return;
+        }
+    }
+}
+
+void profile_step(gb_t *gb, u16 pc) {
+    u16 op = bus_read(gb, pc);
+    u32 len = instr_length(instruction_by_opcode(op));
+
+    if (op == 0xCB) {
+        op = 0x100 | bus_read(gb, pc + 1);
+    }
+
+    // Branches and interrupts break the sequence
+    if (pc != expected_pc) {
+        run = 0;
+    }
+
+    if (run >= 1) {
+        pairs[prev[1]][op]++;
+    }
+
+    if (run >= 2) {
+        count_triple(1 + ((prev[0] << 18) | (prev[1] << 9) | op));
+    }
+
+    prev[0] = prev[1];
+    prev[1] = op;
+    run = run < 2 ? run + 1 : 2;
+    expected_pc = pc + len;
+}
+
+typedef struct {
+    u16 ops[3];
+    u64 count;
+} sequence;
+
+static int compare_sequences(const void *a, const void *b) {
+    u64 ca = ((const sequence *)a)->count;
+    u64 cb = ((const sequence *)b)->count;
+
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static void print_op(u16 op) {
+    if (op & 0x100) {
+        printf(" CB %02X       ", op & 0xFF);
+    } else {
+        printf(" %02X %-8s", op, inst_name(instruction_by_opcode(op)->type));
+    }
+}
+
+static void print_top(sequence *seqs, int num, int len, int count, u64 total) {
+    qsort(seqs, num, sizeof(sequence), compare_sequences);
+
+    for (int i = 0; i < num && i < count; i++) {
+        printf("PROFILE %5.2f%% %12lu ", 100.0 * seqs[i].count / total, (unsigned long)seqs[i].count);
+
+        for (int j = 0; j < len; j++) {
+            print_op(seqs[i].ops[j]);
+        }
+
+        printf("\n");
+    }
+}
+
+void profile_report(gb_t *gb, int count) {
+    sequence *seqs = malloc(sizeof(sequence) * 0x200 * 0x200);
+    int num = 0;
+    u64 total = 0;
+
+    for (int a = 0; a < 0x200; a++) {
+        for (int b = 0; b < 0x200; b++) {
+            if (pairs[a][b]) {
+                seqs[num++] = (sequence){{a, b}, pairs[a][b]};
+                total += pairs[a][b];
+            }
+        }
+    }
+
+    printf("PROFILE pairs (%lu counted)\n", (unsigned long)total);
+    print_top(seqs, num, 2, count, total);
+
+    num = 0;
+    total = 0;
+
+    for (int i = 0; i < TRIPLE_SLOTS; i++) {
+        if (triples[i].key) {
+            u32 key = triples[i].key - 1;
+            seqs[num++] = (sequence){{key >> 18, (key >> 9) & 0x1FF, key & 0x1FF}, triples[i].count};
+            total += triples[i].count;
+        }
+    }
+
+    printf("PROFILE triples (%lu counted)\n", (unsigned long)total);
+    print_top(seqs, num, 3, count, total);
+
+    free(seqs);
+
+    printf("PROFILE IO registers (reads, writes)\n");
+
+    for (u16 address = 0xFF00; address < 0xFF80; address++) {
+        if (io_read_count(gb, address) || io_write_count(gb, address)) {
+            printf("PROFILE %04X %12lu %12lu\n", address,
+                (unsigned long)io_read_count(gb, address), (unsigned long)io_write_count(gb, address));
+        }
+    }
+}
+
+#endif
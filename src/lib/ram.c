@@ -1,13 +1,10 @@
-#include <ram.h>
+#include <gb.h>
 
-typedef struct {
-    u8 wram[0x2000];
-    u8 hram[0x80];
-} ram_context;
-
-static ram_context ctx;
+void ram_init(gb_t *gb) {
+    bus_map(gb, 0xC000, sizeof(gb->ram.wram), gb->ram.wram, gb->ram.wram);
+}
 
-u8 wram_read(u16 address) {
+u8 wram_read(gb_t *gb, u16 address) {
     // Offset WRAM address (0xC000 - 0xDFFF)
     address -= 0xC000;
 
@@ -17,10 +14,10 @@ u8 wram_read(u16 address) {
         exit(-1);
     }
 
-    return ctx.wram[address];
+    return gb->ram.wram[address];
 }
 
-void wram_write(u16 address, u8 value) {
+void wram_write(gb_t *gb, u16 address, u8 value) {
     // Offset WRAM address (0xC000 - 0xDFFF)
     address -= 0xC000;
 
@@ -30,10 +27,11 @@ void wram_write(u16 address, u8 value) {
         exit(-1);
     }
 
-    ctx.wram[address] = value;
+    gb->ram.wram[address] = value;
+    block_ram_write(gb, address + 0xC000);
 }
 
-u8 hram_read(u16 address) {
+u8 hram_read(gb_t *gb, u16 address) {
     // Offset HRAM address (0xFF80 - 0xFFFE)
     address -= 0xFF80;
 
@@ -43,10 +41,10 @@ u8 hram_read(u16 address) {
         exit(-1);
     }
 
-    return ctx.hram[address];
+    return gb->ram.hram[address];
 }
 
-void hram_write(u16 address, u8 value) {
+void hram_write(gb_t *gb, u16 address, u8 value) {
     // Offset HRAM address (0xFF80 - 0xFFFE)
     address -= 0xFF80;
 
@@ -56,5 +54,6 @@ void hram_write(u16 address, u8 value) {
         exit(-1);
     }
 
-    ctx.hram[address] = value;
+    gb->ram.hram[address] = value;
+    block_ram_write(gb, address + 0xFF80);
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <gb.h>
+#include <string.h>
+#include <time.h>
+
+// Emulated ticks per second
+#define TICKS_PER_SECOND 4194304
+
+// Bits each register has
+static const u8 reg_masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+static u64 host_micros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Current reading of the clock source and its units per second
+static u64 clock_now(gb_t *gb) {
+    return gb->rtc.realtime ? host_micros() : gb->emu.ticks;
+}
+
+static u64 clock_rate(rtc_context *ctx) {
+    return ctx->realtime ? 1000000 : TICKS_PER_SECOND;
+}
+
+// Adds days to the 9 bit day counter, setting the carry bit on overflow
+static void add_days(rtc_context *ctx, u64 n) {
+    u64 days = ctx->regs[3] | ((ctx->regs[4] & 0x01) << 8);
+
+    days += n;
+
+    if (days > 0x1FF) {
+        ctx->regs[4] |= 0x80;
+    }
+
+    ctx->regs[3] = days & 0xFF;
+    ctx->regs[4] = (ctx->regs[4] & 0xFE) | ((days >> 8) & 0x01);
+}
+
+// Counts one second. A register set out of range counts up to the limit of
+// its bits and wraps to 0 without carrying.
+static void step(rtc_context *ctx) {
+    u8 *r = ctx->regs;
+
+    r[0] = (r[0] + 1) & 0x3F;
+    if (r[0] != 60) {
+        return;
+    }
+
+    r[0] = 0;
+    r[1] = (r[1] + 1) & 0x3F;
+    if (r[1] != 60) {
+        return;
+    }
+
+    r[1] = 0;
+    r[2] = (r[2] + 1) & 0x1F;
+    if (r[2] != 24) {
+        return;
+    }
+
+    r[2] = 0;
+    add_days(ctx, 1);
+}
+
+// Counts the given seconds at once, with the same result as stepping them
+static void advance(rtc_context *ctx, u64 secs) {
+    u8 *r = ctx->regs;
+
+    while (secs && (r[0] >= 60 || r[1] >= 60 || r[2] >= 24)) {
+        step(ctx);
+        secs--;
+    }
+
+    u64 total = r[0] + r[1] * 60 + r[2] * 3600 + secs;
+
+    r[0] = total % 60;
+    r[1] = total / 60 % 60;
+    r[2] = total / 3600 % 24;
+
+    if (total >= 86400) {
+        add_days(ctx, total / 86400);
+    }
+}
+
+// Brings the registers up to date with the clock source
+static void sync(gb_t *gb) {
+    rtc_context *ctx = &gb->rtc;
+    u64 now = clock_now(gb);
+
+    // A halted clock stands still, and a reset clock source starts over
+    if ((ctx->regs[4] & 0x40) || now < ctx->ref) {
+        ctx->ref = now;
+        return;
+    }
+
+    u64 secs = (now - ctx->ref) / clock_rate(ctx);
+
+    ctx->ref += secs * clock_rate(ctx);
+    advance(ctx, secs);
+}
+
+static void put32(u8 *p, u32 value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+static u64 get_le(const u8 *p, int bytes) {
+    u64 value = 0;
+
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+
+    return value;
+}
+
+void rtc_init(gb_t *gb, u8 *save, bool loaded) {
+    rtc_context *ctx = &gb->rtc;
+
+    ctx->save = save;
+    ctx->latch = false;
+    memset(ctx->regs, 0, sizeof(ctx->regs));
+    memset(ctx->latched, 0, sizeof(ctx->latched));
+
+    if (save && loaded) {
+        for (int i = 0; i < 5; i++) {
+            ctx->regs[i] = get_le(save + i * 4, 4) & reg_masks[i];
+            ctx->latched[i] = get_le(save + 20 + i * 4, 4) & reg_masks[i];
+        }
+
+        // Catch up with the time the emulator was not running
+        u64 stored = get_le(save + 40, 8);
+        u64 now = host_micros() / 1000000;
+
+        if (now > stored && !(ctx->regs[4] & 0x40)) {
+            advance(ctx, now - stored);
+        }
+    }
+
+    ctx->ref = clock_now(gb);
+}
+
+u8 rtc_read(gb_t *gb, u8 reg) {
+    return gb->rtc.latched[reg - 0x08];
+}
+
+void rtc_write(gb_t *gb, u8 reg, u8 value) {
+    rtc_context *ctx = &gb->rtc;
+
+    sync(gb);
+
+    ctx->regs[reg - 0x08] = value & reg_masks[reg - 0x08];
+
+    // Writing the seconds also resets the divider counting them
+    if (reg == 0x08) {
+        ctx->ref = clock_now(gb);
+    }
+}
+
+void rtc_latch(gb_t *gb, u8 value) {
+    rtc_context *ctx = &gb->rtc;
+
+    if (ctx->latch && value == 0x01) {
+        sync(gb);
+        memcpy(ctx->latched, ctx->regs, sizeof(ctx->latched));
+    }
+
+    ctx->latch = value == 0x00;
+}
+
+void rtc_store(gb_t *gb) {
+    rtc_context *ctx = &gb->rtc;
+
+    if (!ctx->save) {
+        return;
+    }
+
+    sync(gb);
+
+    for (int i = 0; i < 5; i++) {
+        put32(ctx->save + i * 4, ctx->regs[i]);
+        put32(ctx->save + 20 + i * 4, ctx->latched[i]);
+    }
+
+    u64 now = host_micros() / 1000000;
+
+    put32(ctx->save + 40, now);
+    put32(ctx->save + 44, now >> 32);
+}
+
+void rtc_set_realtime(gb_t *gb, bool on) {
+    rtc_context *ctx = &gb->rtc;
+
+    sync(gb);
+
+    ctx->realtime = on;
+    ctx->ref = clock_now(gb);
+}
@@ -0,0 +1,117 @@
+#include <gb.h>
+
+static void heap_set(sched_context *s, int i, u8 ev) {
+    s->heap[i] = ev;
+    s->events[ev].pos = i;
+}
+
+static void sift_up(sched_context *s, int i) {
+    u8 ev = s->heap[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (s->events[s->heap[parent]].when <= s->events[ev].when) {
+            break;
+        }
+
+        heap_set(s, i, s->heap[parent]);
+        i = parent;
+    }
+
+    heap_set(s, i, ev);
+}
+
+static void sift_down(sched_context *s, int i) {
+    u8 ev = s->heap[i];
+
+    while (2 * i + 1 < s->heap_len) {
+        int child = 2 * i + 1;
+
+        if (child + 1 < s->heap_len && s->events[s->heap[child + 1]].when < s->events[s->heap[child]].when) {
+            child++;
+        }
+
+        if (s->events[ev].when <= s->events[s->heap[child]].when) {
+            break;
+        }
+
+        heap_set(s, i, s->heap[child]);
+        i = child;
+    }
+
+    heap_set(s, i, ev);
+}
+
+static void update_deadline(sched_context *s) {
+    s->deadline = s->heap_len ? s->events[s->heap[0]].when : UINT64_MAX;
+}
+
+// Takes a pending event out of the heap
+static void heap_remove(sched_context *s, sched_event ev) {
+    int i = s->events[ev].pos;
+
+    s->events[ev].pos = -1;
+    s->heap_len--;
+
+    if (i == s->heap_len) {
+        return;
+    }
+
+    // Fill the hole with the last entry and move it to where it belongs
+    u8 last = s->heap[s->heap_len];
+
+    heap_set(s, i, last);
+    sift_down(s, i);
+    sift_up(s, s->events[last].pos);
+}
+
+void sched_add(gb_t *gb, sched_event ev, u64 when, SCHED_CALLBACK cb) {
+    sched_context *s = &gb->sched;
+
+    if (s->events[ev].pos >= 0) {
+        heap_remove(s, ev);
+    }
+
+    s->events[ev].when = when;
+    s->events[ev].cb = cb;
+
+    heap_set(s, s->heap_len++, ev);
+    sift_up(s, s->heap_len - 1);
+    update_deadline(s);
+}
+
+void sched_cancel(gb_t *gb, sched_event ev) {
+    sched_context *s = &gb->sched;
+
+    if (s->events[ev].pos >= 0) {
+        heap_remove(s, ev);
+        update_deadline(s);
+    }
+}
+
+void sched_run(gb_t *gb, u64 now) {
+    sched_context *s = &gb->sched;
+
+    while (s->heap_len && s->events[s->heap[0]].when <= now) {
+        sched_event ev = s->heap[0];
+        u64 when = s->events[ev].when;
+
+        heap_remove(s, ev);
+        update_deadline(s);
+
+        // The callback may schedule events, including this one again
+        s->events[ev].cb(gb, when);
+    }
+}
+
+void sched_reset(gb_t *gb) {
+    sched_context *s = &gb->sched;
+
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        s->events[i].pos = -1;
+    }
+
+    s->heap_len = 0;
+    update_deadline(s);
+}
@@ -0,0 +1,93 @@
+#include <sha1.h>
+#include <string.h>
+
+// https://datatracker.ietf.org/doc/html/rfc3174
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// Processes one 64 byte chunk
+static void sha1_chunk(u32 h[5], const u8 *p) {
+    u32 w[80];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    }
+
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    u32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+    for (int i = 0; i < 80; i++) {
+        u32 f, k;
+
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        u32 t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void sha1(const u8 *data, size_t len, u8 digest[20]) {
+    u32 h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        sha1_chunk(h, data + i);
+    }
+
+    // Pad the remaining bytes with 0x80, zeroes and the bit length
+    u8 last[128] = {0};
+    size_t rest = len - i;
+    memcpy(last, data + i, rest);
+    last[rest] = 0x80;
+
+    size_t total = rest + 9 > 64 ? 128 : 64;
+    u64 bits = (u64)len * 8;
+
+    for (int j = 0; j < 8; j++) {
+        last[total - 1 - j] = bits >> (j * 8);
+    }
+
+    sha1_chunk(h, last);
+
+    if (total == 128) {
+        sha1_chunk(h, last + 64);
+    }
+
+    for (int j = 0; j < 20; j++) {
+        digest[j] = h[j / 4] >> (24 - (j % 4) * 8);
+    }
+}
+
+void sha1_hex(const u8 *data, size_t len, char hex[41]) {
+    u8 digest[20];
+    sha1(data, len, digest);
+
+    for (int i = 0; i < 20; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+}
@@ -1,6 +1,5 @@
 #include <stack.h>
-#include <cpu.h>
-#include <bus.h>
+#include <gb.h>
 
 /*
     STACK
@@ -84,25 +83,25 @@
     0xDFFF: 00
 */
 
-void stack_push(u8 data) {
-    cpu_get_regs()->sp--;
-    bus_write(cpu_get_regs()->sp, data);
+void stack_push(cpu_context *ctx, u8 data) {
+    ctx->regs.sp--;
+    bus_write(GB(ctx), ctx->regs.sp, data);
 }
 
-void stack_push16(u16 data) {
+void stack_push16(cpu_context *ctx, u16 data) {
     // Push the high byte first
-    stack_push(data >> 8 & 0xFF);
-    stack_push(data & 0xFF);
+    stack_push(ctx, data >> 8 & 0xFF);
+    stack_push(ctx, data & 0xFF);
 }
 
-u8 stack_pop() {
-    return bus_read(cpu_get_regs()->sp++);
+u8 stack_pop(cpu_context *ctx) {
+    return bus_read(GB(ctx), ctx->regs.sp++);
 }
 
-u16 stack_pop16() {
+u16 stack_pop16(cpu_context *ctx) {
     // Pop the low byte first
-    u16 lo = stack_pop();
-    u16 hi = stack_pop();
+    u16 lo = stack_pop(ctx);
+    u16 hi = stack_pop(ctx);
     
     // Combine the two bytes
     return (hi << 8) | lo;
@@ -1,82 +1,216 @@
-#include <timer.h>
+#include <gb.h>
 #include <interrupts.h>
 
-static timer_context ctx = {0};
+void timer_init(gb_t *gb) {
+    timer_context *ctx = &gb->timer;
 
-timer_context *timer_get_context() {
-    return &ctx;
+    // Initialise divider register
+    ctx->div = 0xAC00;
+    ctx->ticks = 0;
+
+    sched_cancel(gb, SCHED_TIMER);
+
+    io_register(gb, 0xFF04, 3, timer_read, timer_write, 0);
+    io_register(gb, 0xFF07, 1, timer_read, timer_write, 0xF8);
 }
 
-void timer_init() {
-    // Initialise divider register
-    ctx.div = 0xAC00;
+// Falling edge period of the DIV bit selected by TAC, in ticks
+static const u16 tima_periods[4] = {1024, 16, 64, 256};
+
+// TIMA counts falling edges of the selected DIV bit ANDed with the enable bit
+static bool tima_input(u16 div, u8 tac) {
+    return (tac & (1 << 2)) && (div & (tima_periods[tac & 0b11] >> 1));
 }
 
-void timer_tick() {
-    u16 prev_div = ctx.div;
+// Increments TIMA, reloading it and requesting an interrupt on overflow
+static void tima_increment(gb_t *gb) {
+    timer_context *ctx = &gb->timer;
 
-    ctx.div++;
+    ctx->tima++;
 
-    bool timer_update = false;
+    if (ctx->tima == 0xFF) {
+        ctx->tima = ctx->tma;
 
-    // Check if the timer should be updated
-    switch(ctx.tac & (0b11)) {
-        case 0b00:
-            timer_update = (prev_div & (1 << 9)) && (!(ctx.div & (1 << 9)));
-            break;
-        case 0b01:
-            timer_update = (prev_div & (1 << 3)) && (!(ctx.div & (1 << 3)));
-            break;
-        case 0b10:
-            timer_update = (prev_div & (1 << 5)) && (!(ctx.div & (1 << 5)));
-            break;
-        case 0b11:
-            timer_update = (prev_div & (1 << 7)) && (!(ctx.div & (1 << 7)));
-            break;
+        cpu_request_interrupt(gb, INT_TIMER);
     }
+}
 
-    if (timer_update && ctx.tac & (1 << 2)) {
-        ctx.tima++;
+// Returns the increments from value until TIMA next overflows
+static u32 increments_to_overflow(u8 value) {
+    u8 n = 0xFF - value;
 
-        if (ctx.tima == 0xFF) {
-            ctx.tima = ctx.tma;
+    return n ? n : 0x100;
+}
 
-            cpu_request_interrupt(INT_TIMER);
-        }
+// Returns the TIMA increments the next ticks will make
+static u32 tima_edges(timer_context *ctx, u32 ticks) {
+    if (!(ctx->tac & (1 << 2))) {
+        return 0;
     }
+
+    u32 period = tima_periods[ctx->tac & 0b11];
+
+    return ((ctx->div & (period - 1)) + ticks) / period;
 }
 
-void timer_write(u16 address, u8 value) {
+// Increments TIMA n times at once
+static void tima_advance(gb_t *gb, u32 n) {
+    timer_context *ctx = &gb->timer;
+
+    u32 first = increments_to_overflow(ctx->tima);
+
+    if (n < first) {
+        ctx->tima += n;
+        return;
+    }
+
+    // After the first overflow TIMA cycles from TMA
+    ctx->tima = ctx->tma + (n - first) % increments_to_overflow(ctx->tma);
+
+    cpu_request_interrupt(gb, INT_TIMER);
+}
+
+void timer_tick(gb_t *gb) {
+    timer_context *ctx = &gb->timer;
+
+    u16 prev_div = ctx->div;
+
+    ctx->div++;
+
+    if (tima_input(prev_div, ctx->tac) && !tima_input(ctx->div, ctx->tac)) {
+        tima_increment(gb);
+    }
+}
+
+void timer_skip(gb_t *gb, u32 ticks) {
+    tima_advance(gb, tima_edges(&gb->timer, ticks));
+
+    gb->timer.div += ticks;
+}
+
+// Ticks since the registers were last written or TIMA last overflowed.
+// Overflow events keep a running timer within a few frames of the clock,
+// and a stopped one only needs the low 16 bits for DIV.
+static u32 elapsed(gb_t *gb) {
+    return gb->emu.ticks - gb->timer.ticks;
+}
+
+// Advances the registers to the given emulator tick
+static void sync_to(gb_t *gb, u64 ticks) {
+    if (ticks > gb->timer.ticks) {
+        timer_skip(gb, ticks - gb->timer.ticks);
+        gb->timer.ticks = ticks;
+    }
+}
+
+void timer_sync(gb_t *gb) {
+    sync_to(gb, gb->emu.ticks);
+}
+
+static u32 ticks_to_tima(timer_context *ctx) {
+    if (!(ctx->tac & (1 << 2))) {
+        return 0;
+    }
+
+    u32 period = tima_periods[ctx->tac & 0b11];
+
+    return period - (ctx->div & (period - 1));
+}
+
+static u32 ticks_to_overflow(timer_context *ctx) {
+    if (!(ctx->tac & (1 << 2))) {
+        return 0;
+    }
+
+    return ticks_to_tima(ctx) + (increments_to_overflow(ctx->tima) - 1) * tima_periods[ctx->tac & 0b11];
+}
+
+// Catches up with the overflow, which requests the interrupt
+static void overflow_event(gb_t *gb, u64 when) {
+    sync_to(gb, when);
+    timer_reschedule(gb);
+}
+
+void timer_reschedule(gb_t *gb) {
+    u32 ticks = ticks_to_overflow(&gb->timer);
+
+    if (ticks) {
+        sched_add(gb, SCHED_TIMER, gb->timer.ticks + ticks, overflow_event);
+    } else {
+        sched_cancel(gb, SCHED_TIMER);
+    }
+}
+
+u32 timer_ticks_to_div(gb_t *gb) {
+    timer_sync(gb);
+
+    return 0x100 - (gb->timer.div & 0xFF);
+}
+
+u32 timer_ticks_to_tima(gb_t *gb) {
+    timer_sync(gb);
+
+    return ticks_to_tima(&gb->timer);
+}
+
+u32 timer_ticks_to_overflow(gb_t *gb) {
+    timer_sync(gb);
+
+    return ticks_to_overflow(&gb->timer);
+}
+
+void timer_write(gb_t *gb, u16 address, u8 value) {
+    timer_context *ctx = &gb->timer;
+
+    timer_sync(gb);
+
+    bool input = tima_input(ctx->div, ctx->tac);
+
     switch(address) {
         //DIV
         case 0xFF04:
-            ctx.div = 0;
+            ctx->div = 0;
+
+            // Resetting DIV can make the selected bit fall
+            if (input) {
+                tima_increment(gb);
+            }
             break;
         //TIMA
         case 0xFF05:
-            
-            ctx.tima = value;
+
+            ctx->tima = value;
             break;
         //TMA
         case 0xFF06:
-            ctx.tma = value;
+            ctx->tma = value;
             break;
         //TAC
         case 0xFF07:
-            ctx.tac = value;
+            ctx->tac = value;
+
+            // So can selecting another bit or disabling the timer
+            if (input && !tima_input(ctx->div, ctx->tac)) {
+                tima_increment(gb);
+            }
             break;
     }
+
+    timer_reschedule(gb);
 }
 
-u8 timer_read(u16 address) {
+u8 timer_read(gb_t *gb, u16 address) {
+    timer_context *ctx = &gb->timer;
+
+    // Computed from the clock, no overflow can be due before the next event
     switch(address) {
         case 0xFF04:
-            return ctx.div >> 8;
+            return (u16)(ctx->div + elapsed(gb)) >> 8;
         case 0xFF05:
-            return ctx.tima;
+            return ctx->tima + tima_edges(ctx, elapsed(gb));
         case 0xFF06:
-            return ctx.tma;
+            return ctx->tma;
         case 0xFF07:
-            return ctx.tac;
+            return ctx->tac;
     }
-}
\ No newline at end of file
+}
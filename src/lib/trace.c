@@ -0,0 +1,223 @@
+#include <trace.h>
+#include <gb.h>
+
+void trace_format(const trace_record *rec, char *str, size_t size) {
+    // Rebuild just enough of a CPU context to reuse the disassembler
+    cpu_context ctx = {0};
+    ctx.curr_opcode = rec->opcode;
+    ctx.curr_instr = instruction_by_opcode(rec->opcode);
+    ctx.fetched_data = rec->operands[0] | (rec->operands[1] << 8);
+    ctx.mem_dest = ctx.fetched_data;
+
+    char instr[16];
+    instr_to_str(&ctx, instr);
+
+    snprintf(str, size, "%08lX - %04X: %-12s (%02X %02X %02X) A: %02X F: %c%c%c%c BC: %02X%02X DE: %02X%02X HL: %02X%02X SP: %04X",
+        (unsigned long)rec->ticks, rec->pc, instr, rec->opcode, rec->operands[0], rec->operands[1], rec->a,
+        rec->f & (1 << 7) ? 'Z' : '-',
+        rec->f & (1 << 6) ? 'N' : '-',
+        rec->f & (1 << 5) ? 'H' : '-',
+        rec->f & (1 << 4) ? 'C' : '-',
+        rec->b, rec->c, rec->d, rec->e, rec->h, rec->l, rec->sp);
+}
+
+#ifdef GBEMU_TRACE
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Number of records in the ring buffer (must be a power of 2)
+#define TRACE_RING_SIZE (1 << 16)
+
+// Single producer (the instance's CPU thread), single consumer (its
+// decoder thread)
+struct trace_ring {
+    trace_record records[TRACE_RING_SIZE];
+    _Atomic u32 head; // Next slot the CPU writes
+    _Atomic u32 tail; // Next slot the decoder reads
+
+    // The record at head is still being filled in (operands), the decoder
+    // only gets it with the next trace_step
+    bool pending;
+    u8 num_operands;
+
+    pthread_t thread;
+    atomic_bool stopping;
+
+    trace_ring *next; // Next ring still decoding
+};
+
+// Rings whose decoder is still running, printed at exit
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring *rings;
+
+// Decoder thread: drains the ring buffer and prints each record, until
+// stop asks it to and nothing is left
+static void *trace_run(void *p) {
+    trace_ring *ring = p;
+    char line[128];
+
+    while (true) {
+        bool stop = atomic_load_explicit(&ring->stopping, memory_order_acquire);
+        u32 tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (tail == head) {
+            fflush(stdout);
+
+            if (stop) {
+                break;
+            }
+
+            usleep(1000);
+            continue;
+        }
+
+        while (tail != head) {
+            trace_format(&ring->records[tail & (TRACE_RING_SIZE - 1)], line, sizeof(line));
+            puts(line);
+            tail++;
+        }
+
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    return 0;
+}
+
+// Publishes the pending record and waits for the decoder to print the rest
+static void stop(trace_ring *ring) {
+    if (ring->pending) {
+        ring->pending = false;
+        atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+    }
+
+    atomic_store_explicit(&ring->stopping, true, memory_order_release);
+    pthread_join(ring->thread, NULL);
+}
+
+// The records leading up to an exit (e.g. NO_IMPL) are the interesting ones
+static void trace_exit() {
+    pthread_mutex_lock(&lock);
+    trace_ring *ring = rings;
+    rings = NULL;
+    pthread_mutex_unlock(&lock);
+
+    // The instances may still use their rings, so only stop them
+    for (; ring; ring = ring->next) {
+        stop(ring);
+    }
+}
+
+static void register_exit() {
+    atexit(trace_exit);
+}
+
+void trace_init(gb_t *gb) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, register_exit);
+
+    trace_ring *ring = calloc(1, sizeof(trace_ring));
+
+    if (!ring) {
+        fprintf(stderr, "FAILED TO ALLOCATE TRACE RING!\n");
+        return;
+    }
+
+    if (pthread_create(&ring->thread, NULL, trace_run, ring)) {
+        fprintf(stderr, "FAILED TO START TRACE THREAD!\n");
+        free(ring);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&lock);
+
+    gb->trace.ring = ring;
+}
+
+void trace_free(gb_t *gb) {
+    trace_ring *ring = gb->trace.ring;
+
+    if (!ring) {
+        return;
+    }
+
+    // Stop the decoder unless the exit handler already has
+    bool running = false;
+
+    pthread_mutex_lock(&lock);
+
+    for (trace_ring **p = &rings; *p; p = &(*p)->next) {
+        if (*p == ring) {
+            *p = ring->next;
+            running = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (running) {
+        stop(ring);
+    }
+
+    free(ring);
+    gb->trace.ring = NULL;
+}
+
+void trace_step(cpu_context *ctx, u16 pc, u8 opcode, u16 operands) {
+    trace_ring *ring = GB(ctx)->trace.ring;
+
+    if (!ring) {
+        return;
+    }
+
+    u32 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (ring->pending) {
+        atomic_store_explicit(&ring->head, ++head, memory_order_release);
+    }
+
+    // Wait for the decoder rather than drop records when the ring is full
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+        sched_yield();
+    }
+
+    trace_record *rec = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    rec->ticks = GB(ctx)->emu.ticks;
+    rec->pc = pc;
+    rec->sp = ctx->regs.sp;
+    rec->opcode = opcode;
+    rec->operands[0] = operands & 0xFF;
+    rec->operands[1] = operands >> 8;
+    rec->a = ctx->regs.a;
+    rec->f = cpu_get_f(ctx);
+    rec->b = ctx->regs.b;
+    rec->c = ctx->regs.c;
+    rec->d = ctx->regs.d;
+    rec->e = ctx->regs.e;
+    rec->h = ctx->regs.h;
+    rec->l = ctx->regs.l;
+
+    ring->pending = true;
+    ring->num_operands = 0;
+}
+
+void trace_operand(cpu_context *ctx, u8 value) {
+    trace_ring *ring = GB(ctx)->trace.ring;
+
+    if (!ring || !ring->pending || ring->num_operands == 2) {
+        return;
+    }
+
+    u32 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->records[head & (TRACE_RING_SIZE - 1)].operands[ring->num_operands++] = value;
+}
+
+#endif
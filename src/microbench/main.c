@@ -0,0 +1,443 @@
+#include <gb.h>
+#include <instructions.h>
+#include <interrupts.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+// Inputs are drawn from tables of this many entries (a power of two)
+#define INPUTS 4096
+
+// Where the instruction under test and its operands are placed
+#define CODE_ADDR 0xC000
+
+// Synthetic cartridge: MBC1 with 8KB of RAM, 4 ROM banks of random bytes
+#define ROM_BANKS 4
+
+typedef void (*BENCH_FN)(void *arg, u32 n);
+
+// A memory region and the addresses and values used in it
+typedef struct {
+    const char *name;
+    u16 start;
+    u32 size;
+    u16 addrs[INPUTS];
+    u8 values[INPUTS];
+} region;
+
+// An instruction, and the CPU state it starts from every time
+typedef struct {
+    instruction *instr;
+    u8 opcode;
+    IN_PROC proc;
+    cpu_registers regs;
+    u16 fetched_data;
+    u16 mem_dest;
+    bool dest_is_mem;
+} instr_input;
+
+static const char *mode_names[] = {
+    "imp", "r_d16", "r_r", "mr_r", "r", "r_d8", "r_mr", "r_hli", "r_hld", "hli_r", "hld_r",
+    "r_a8", "a8_r", "hl_spr", "d16", "d8", "d16_r", "mr_d8", "mr", "a16_r", "r_a16"
+};
+
+// VRAM and OAM are not emulated yet, and only print a warning
+static region regions[] = {
+    {"rom0", 0x0000, 0x4000},
+    {"romx", 0x4000, 0x4000},
+    {"eram", 0xA000, 0x2000},
+    {"wram", 0xC000, 0x2000},
+    {"echo", 0xE000, 0x1E00},
+    {"io", 0xFF00, 0x80},
+    {"hram", 0xFF80, 0x7F},
+    {"ie", 0xFFFF, 1},
+};
+
+// IO registers with handlers (serial, timer, IF)
+static const u16 io_addrs[] = {0xFF01, 0xFF02, 0xFF04, 0xFF05, 0xFF06, 0xFF07, 0xFF0F};
+
+static gb_t *gb;
+static u32 iterations = 1 << 20;
+static int runs = 5;
+static const char *filter = NULL;
+static FILE *tsv = NULL;
+static volatile u32 sink;
+static u32 seed = 0x12345678;
+
+static u32 next_rand() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs fn for the given number of operations, runs times, and prints the
+// mean and standard deviation of the time per operation
+static void measure(const char *name, BENCH_FN fn, void *arg) {
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+
+    double ns[runs];
+    double mean = 0;
+    double var = 0;
+
+    // Warm up the caches and the branch predictors
+    fn(arg, iterations / 16);
+
+    for (int r = 0; r < runs; r++) {
+        double start = now();
+        fn(arg, iterations);
+        ns[r] = (now() - start) * 1e9 / iterations;
+        mean += ns[r] / runs;
+    }
+
+    for (int r = 0; r < runs; r++) {
+        var += (ns[r] - mean) * (ns[r] - mean);
+    }
+
+    double stddev = runs > 1 ? sqrt(var / (runs - 1)) : 0;
+
+    printf("MICRO %-24s %8.2f ns (+-%.2f)\n", name, mean, stddev);
+
+    if (tsv) {
+        fprintf(tsv, "%s\t%.4f\t%.4f\t%u\t%d\n", name, mean, stddev, iterations, runs);
+    }
+}
+
+// Writes the synthetic cartridge to a temporary file and loads it
+static bool load_cart() {
+    static u8 rom[ROM_BANKS * 0x4000];
+    char path[] = "/tmp/gbmicroXXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    for (u32 i = 0; i < sizeof(rom); i++) {
+        rom[i] = next_rand();
+    }
+
+    memset(rom + 0x100, 0, 0x50);
+    rom[0x147] = 0x02; // MBC1+RAM
+    rom[0x148] = 0x01; // 64KB
+    rom[0x149] = 0x02; // 8KB
+
+    u8 x = 0;
+
+    for (u16 i = 0x134; i <= 0x14C; i++) {
+        x = x - rom[i] - 1;
+    }
+
+    rom[0x14D] = x;
+
+    bool ok = write(fd, rom, sizeof(rom)) == sizeof(rom);
+    close(fd);
+
+    ok = ok && cart_load(gb, path);
+    unlink(path);
+    return ok;
+}
+
+static void fill_region(region *r) {
+    for (int i = 0; i < INPUTS; i++) {
+        r->addrs[i] = r->start + next_rand() % r->size;
+        r->values[i] = next_rand();
+
+        if (r->start == 0xFF00) {
+            r->addrs[i] = io_addrs[next_rand() % (sizeof(io_addrs) / sizeof(io_addrs[0]))];
+        }
+    }
+}
+
+static void bench_bus_read(void *arg, u32 n) {
+    region *r = arg;
+    u32 sum = 0;
+
+    for (u32 i = 0; i < n; i++) {
+        sum += bus_read(gb, r->addrs[i & (INPUTS - 1)]);
+    }
+
+    sink = sum;
+}
+
+static void bench_bus_write(void *arg, u32 n) {
+    region *r = arg;
+
+    for (u32 i = 0; i < n; i++) {
+        bus_write(gb, r->addrs[i & (INPUTS - 1)], r->values[i & (INPUTS - 1)]);
+    }
+}
+
+// Writes to the cartridge are MBC register writes, these select ROM banks
+static void bench_bank_switch(void *arg, u32 n) {
+    region *r = arg;
+
+    for (u32 i = 0; i < n; i++) {
+        bus_write(gb, 0x2000 | (r->addrs[i & (INPUTS - 1)] & 0x1FFF), 1 + r->values[i & (INPUTS - 1)] % (ROM_BANKS - 1));
+    }
+}
+
+// Puts the CPU into the state the instruction starts from
+static inline void restore(cpu_context *ctx, const instr_input *in) {
+    ctx->regs = in->regs;
+    ctx->lf_op = LF_NONE;
+    ctx->halted = false;
+    ctx->interrupt_master_enabled = false;
+    ctx->enabling_ime = false;
+    ctx->curr_instr = in->instr;
+    ctx->curr_opcode = in->opcode;
+    ctx->fetched_data = in->fetched_data;
+    ctx->mem_dest = in->mem_dest;
+    ctx->dest_is_mem = in->dest_is_mem;
+}
+
+static void bench_fetch_data(void *arg, u32 n) {
+    instr_input *in = arg;
+    cpu_context *ctx = &gb->cpu;
+    u32 sum = 0;
+
+    for (u32 i = 0; i < n; i++) {
+        restore(ctx, in);
+        fetch_data(ctx);
+        sum += ctx->fetched_data;
+    }
+
+    sink = sum;
+}
+
+static void bench_proc(void *arg, u32 n) {
+    instr_input *in = arg;
+    cpu_context *ctx = &gb->cpu;
+
+    for (u32 i = 0; i < n; i++) {
+        restore(ctx, in);
+        in->proc(ctx);
+    }
+}
+
+static void bench_set_flags(void *arg, u32 n) {
+    const char (*flags)[4] = arg;
+    cpu_context *ctx = &gb->cpu;
+
+    for (u32 i = 0; i < n; i++) {
+        const char *f = flags[i & (INPUTS - 1)];
+        cpu_set_flags(ctx, f[0], f[1], f[2], f[3]);
+    }
+
+    sink = ctx->regs.f;
+}
+
+static void bench_timer_tick(void *arg, u32 n) {
+    for (u32 i = 0; i < n; i++) {
+        timer_tick(gb);
+    }
+}
+
+static void bench_interrupts(void *arg, u32 n) {
+    const u8 *pending = arg;
+    cpu_context *ctx = &gb->cpu;
+
+    for (u32 i = 0; i < n; i++) {
+        ctx->regs.sp = 0xDFF0;
+        ctx->interrupt_master_enabled = true;
+        ctx->int_flags = pending[i & (INPUTS - 1)];
+        cpu_update_int_pending(ctx);
+        cpu_handle_interrupts(ctx);
+    }
+}
+
+// Registers pointing into WRAM, so memory operands stay in work RAM
+static cpu_registers start_regs() {
+    cpu_registers regs = gb->cpu.regs;
+
+    regs.a = 0x5A;
+    regs.f = 0xB0;
+    regs.bc = 0xC200;
+    regs.de = 0xC300;
+    regs.hl = 0xC100;
+    regs.sp = 0xDFF0;
+    regs.pc = CODE_ADDR + 1;
+    return regs;
+}
+
+// Sets up an instruction as the table dispatch would have fetched it
+static void setup_instr(instr_input *in, u8 opcode) {
+    cpu_context *ctx = &gb->cpu;
+
+    in->instr = instruction_by_opcode(opcode);
+    in->opcode = opcode;
+    in->proc = inst_get_processor(in->instr->type);
+    in->regs = start_regs();
+
+    // Operands: HRAM for 8-bit addresses, 0xFF86 for 16-bit ones,
+    // RES 0,(HL) after CB
+    bus_write(gb, CODE_ADDR, opcode);
+    bus_write(gb, CODE_ADDR + 1, 0x86);
+    bus_write(gb, CODE_ADDR + 2, 0xFF);
+
+    in->fetched_data = 0;
+    in->mem_dest = 0;
+    in->dest_is_mem = false;
+    restore(ctx, in);
+    fetch_data(ctx);
+
+    in->fetched_data = ctx->fetched_data;
+    in->mem_dest = ctx->mem_dest;
+    in->dest_is_mem = ctx->dest_is_mem;
+}
+
+// The first opcode of the given type, or -1 if there is none
+static int opcode_of_type(in_type type) {
+    for (int op = 0; op < 0x100; op++) {
+        instruction *instr = instruction_by_opcode(op);
+
+        if (instr && instr->type == type) {
+            return op;
+        }
+    }
+
+    return -1;
+}
+
+// The first opcode with the given addressing mode, or -1 if there is none
+static int opcode_of_mode(addr_mode mode) {
+    for (int op = 0; op < 0x100; op++) {
+        instruction *instr = instruction_by_opcode(op);
+
+        if (instr && instr->type != IN_NONE && instr->mode == mode) {
+            return op;
+        }
+    }
+
+    return -1;
+}
+
+static void usage() {
+    printf("Usage: gbmicrobench [-r runs] [-n iterations] [-o results.tsv] [filter]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *out = NULL;
+    char name[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:n:o:")) != -1) {
+        switch (opt) {
+            case 'r': runs = atoi(optarg); break;
+            case 'n': iterations = strtoul(optarg, NULL, 0); break;
+            case 'o': out = optarg; break;
+
+            default:
+                usage();
+                return -1;
+        }
+    }
+
+    if (runs < 1 || !iterations) {
+        usage();
+        return -1;
+    }
+
+    filter = optind < argc ? argv[optind] : NULL;
+
+    gb = gb_create();
+
+    if (!gb || !load_cart()) {
+        printf("Failed to set up the emulator\n");
+        return -2;
+    }
+
+    if (out && !(tsv = fopen(out, "w"))) {
+        printf("Failed to create %s\n", out);
+        return -3;
+    }
+
+    if (tsv) {
+        fprintf(tsv, "benchmark\tns_per_op\tns_per_op_stddev\titerations\truns\n");
+    }
+
+    // Enable the cartridge RAM and run the timer at its fastest rate
+    bus_write(gb, 0x0000, 0x0A);
+    timer_write(gb, 0xFF07, 0x05);
+
+    int num_regions = sizeof(regions) / sizeof(regions[0]);
+
+    for (int i = 0; i < num_regions; i++) {
+        fill_region(&regions[i]);
+        snprintf(name, sizeof(name), "bus_read/%s", regions[i].name);
+        measure(name, bench_bus_read, &regions[i]);
+    }
+
+    measure("bus_write/mbc", bench_bank_switch, &regions[0]);
+
+    for (int i = 0; i < num_regions; i++) {
+        if (regions[i].start < 0x8000) {
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "bus_write/%s", regions[i].name);
+        measure(name, bench_bus_write, &regions[i]);
+    }
+
+    static instr_input in;
+
+    for (int mode = AM_IMP; mode <= AM_R_A16; mode++) {
+        int op = opcode_of_mode(mode);
+
+        if (op >= 0) {
+            setup_instr(&in, op);
+            snprintf(name, sizeof(name), "fetch_data/%s", mode_names[mode]);
+            measure(name, bench_fetch_data, &in);
+        }
+    }
+
+    for (int type = IN_NOP; type < IN_ERR; type++) {
+        int op = opcode_of_type(type);
+
+        if (op < 0 || !inst_get_processor(type)) {
+            continue;
+        }
+
+        setup_instr(&in, op);
+        snprintf(name, sizeof(name), "proc/%s", inst_name(type));
+        measure(name, bench_proc, &in);
+    }
+
+    // Set, reset and keep (-1) in every combination
+    static char flags[INPUTS][4];
+
+    for (int i = 0; i < INPUTS; i++) {
+        for (int f = 0; f < 4; f++) {
+            flags[i][f] = (int)(next_rand() % 3) - 1;
+        }
+    }
+
+    measure("cpu_set_flags", bench_set_flags, flags);
+    measure("timer_tick", bench_timer_tick, NULL);
+
+    // One or more interrupts requested at a time
+    static u8 pending[INPUTS];
+
+    for (int i = 0; i < INPUTS; i++) {
+        pending[i] = 1 + next_rand() % 0x1F;
+    }
+
+    gb->cpu.ie_register = 0x1F;
+    measure("cpu_handle_interrupts", bench_interrupts, pending);
+
+    if (tsv) {
+        fclose(tsv);
+    }
+
+    gb_destroy(gb);
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include <gb.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Test ROMs that report over the serial port (Blargg's) end with one of these
+#define TEXT_PASSED "Passed"
+#define TEXT_FAILED "Failed"
+
+typedef enum {
+    RESULT_PASSED,
+    RESULT_FAILED,
+    RESULT_TIMEOUT, // Cycle budget used up without a verdict
+    RESULT_ERROR,   // The ROM could not be loaded
+    RESULT_CRASHED  // The emulator exited or was killed
+} rom_result;
+
+static const char *result_names[] = {"passed", "failed", "timeout", "error", "crashed"};
+
+typedef struct {
+    const char *path;
+    rom_result result;
+    u64 cycles; // M-cycles run
+    double wall;
+    double started;
+    pid_t pid;
+    bool done; // Set by the child once the result is complete
+    char serial[sizeof(((debug_context *)0)->msg)];
+} rom_run;
+
+// Shared with the children, each writes its own entry
+static rom_run *runs;
+static int num_runs;
+static u64 budget;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs one ROM on an instance of its own until it reports or runs out of cycles
+static void run_rom(rom_run *run) {
+    double start = now();
+    gb_t *gb = gb_create();
+
+    run->result = RESULT_ERROR;
+
+    if (!gb || !cart_load(gb, (char *)run->path)) {
+        gb_destroy(gb);
+        return;
+    }
+
+    gb->debug.quiet = true;
+    run->result = RESULT_TIMEOUT;
+
+    // The verdict is only looked for once a frame, the progress is kept in
+    // case the emulator does not come back
+    while (gb->emu.ticks / 4 < budget) {
+        emu_run_frame(gb);
+        run->cycles = gb->emu.ticks / 4;
+        memcpy(run->serial, gb->debug.msg, sizeof(run->serial));
+
+        if (strstr(gb->debug.msg, TEXT_FAILED)) {
+            run->result = RESULT_FAILED;
+            break;
+        }
+
+        if (strstr(gb->debug.msg, TEXT_PASSED)) {
+            run->result = RESULT_PASSED;
+            break;
+        }
+    }
+
+    run->wall = now() - start;
+
+    gb_destroy(gb);
+}
+
+// Runs a ROM in a child process, so a ROM that makes the emulator exit or
+// crash cannot take the others down with it
+static bool start_rom(rom_run *run) {
+    // The child would print what is still buffered again
+    fflush(stdout);
+
+    run->started = now();
+
+    // Only the parent may write the pid, the entry is shared
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        fprintf(stderr, "Failed to start a process for %s\n", run->path);
+        return false;
+    }
+
+    if (!pid) {
+        // Emulator logging would drown the results
+        freopen("/dev/null", "w", stdout);
+        run_rom(run);
+        run->done = true;
+        _exit(0);
+    }
+
+    run->pid = pid;
+    return true;
+}
+
+// Waits for any child to finish and returns its run, NULL if none is left
+static rom_run *wait_rom() {
+    pid_t pid;
+
+    while ((pid = wait(NULL)) > 0) {
+        rom_run *run = NULL;
+
+        for (int i = 0; i < num_runs && !run; i++) {
+            if (runs[i].pid == pid) {
+                run = &runs[i];
+            }
+        }
+
+        if (!run) {
+            continue;
+        }
+
+        if (!run->done) {
+            run->result = RESULT_CRASHED;
+            run->wall = now() - run->started;
+        }
+
+        printf("%-7s %s: %lu M-cycles, %.3f s\n", result_names[run->result],
+            run->path, (unsigned long)run->cycles, run->wall);
+        return run;
+    }
+
+    return NULL;
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if (*s == '\n') {
+            fputs("\\n", f);
+        } else if ((u8)*s < 0x20 || (u8)*s >= 0x7F) {
+            fprintf(f, "\\u%04x", (u8)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+
+    fputc('"', f);
+}
+
+static bool write_json(const char *path, int *counts) {
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    fprintf(f, "{\n  \"cycle_budget\": %lu,\n  \"roms\": [\n", (unsigned long)budget);
+
+    for (int i = 0; i < num_runs; i++) {
+        rom_run *run = &runs[i];
+        const char *name = strrchr(run->path, '/');
+
+        fprintf(f, "    {\"rom\": ");
+        write_json_string(f, name ? name + 1 : run->path);
+        fprintf(f, ", \"result\": \"%s\", \"mcycles\": %lu, \"wall_s\": %.6f, \"serial\": ",
+            result_names[run->result], (unsigned long)run->cycles, run->wall);
+        write_json_string(f, run->serial);
+        fprintf(f, "}%s\n", i + 1 < num_runs ? "," : "");
+    }
+
+    fprintf(f, "  ],\n");
+
+    for (int r = 0; r <= RESULT_CRASHED; r++) {
+        fprintf(f, "  \"%s\": %d%s\n", result_names[r], counts[r], r < RESULT_CRASHED ? "," : "");
+    }
+
+    fprintf(f, "}\n");
+    fclose(f);
+    return true;
+}
+
+static void usage() {
+    printf("Usage: gbromtest [-j jobs] [-c max_mcycles] [-o results.json] <rom_file>...\n");
+}
+
+int main(int argc, char **argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out = "romtest.json";
+    int opt;
+
+    budget = 100000000;
+
+    while ((opt = getopt(argc, argv, "j:c:o:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atol(optarg); break;
+            case 'c': budget = strtoull(optarg, NULL, 0); break;
+            case 'o': out = optarg; break;
+
+            default:
+                usage();
+                return -1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        return -1;
+    }
+
+    num_runs = argc - optind;
+    runs = mmap(NULL, num_runs * sizeof(rom_run), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (runs == MAP_FAILED) {
+        fprintf(stderr, "Failed to allocate the results\n");
+        return -1;
+    }
+
+    for (int i = 0; i < num_runs; i++) {
+        runs[i].path = argv[optind + i];
+    }
+
+    if (jobs < 1) {
+        jobs = 1;
+    } else if (jobs > num_runs) {
+        jobs = num_runs;
+    }
+
+    // Keep jobs ROMs running at a time
+    double start = now();
+    int running = 0;
+
+    for (int i = 0; i < num_runs; i++) {
+        if (running == jobs && wait_rom()) {
+            running--;
+        }
+
+        if (!start_rom(&runs[i])) {
+            return -1;
+        }
+
+        running++;
+    }
+
+    while (running && wait_rom()) {
+        running--;
+    }
+
+    int counts[RESULT_CRASHED + 1] = {0};
+
+    for (int i = 0; i < num_runs; i++) {
+        counts[runs[i].result]++;
+    }
+
+    printf("%d passed, %d failed, %d timed out, %d not loaded, %d crashed in %.3f s (%ld jobs)\n",
+        counts[RESULT_PASSED], counts[RESULT_FAILED], counts[RESULT_TIMEOUT], counts[RESULT_ERROR],
+        counts[RESULT_CRASHED], now() - start, jobs);
+
+    if (!write_json(out, counts)) {
+        return -1;
+    }
+
+    munmap(runs, num_runs * sizeof(rom_run));
+    return counts[RESULT_PASSED] == num_runs ? 0 : 1;
+}
@@ -1,20 +1,1061 @@
 #include <check.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <emu.h>
+#include <gb.h>
 
-#include <cpu.h>
+#include <alu.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <interrupts.h>
+#include <pthread.h>
+#include <string.h>
+
+// Instance every test runs on
+static gb_t *gb;
+
+static void gb_setup() {
+    gb = gb_create();
+}
+
+static void gb_teardown() {
+    gb_destroy(gb);
+    gb = NULL;
+}
 
 START_TEST(test_nothing) {
-    bool b = cpu_step();
-    ck_assert_uint_eq(b, false);
+    // Without a cartridge the CPU runs open bus (0xFF, RST 38)
+    ck_assert(cpu_step(gb));
+    ck_assert(gb->emu.ticks > 0);
+} END_TEST
+
+// Memory window used by the differential test: code at 0xC100, every
+// pointer register and the stack inside 0xC000 - 0xC1FF
+#define DIFF_BASE 0xC000
+#define DIFF_SIZE 0x200
+
+// IO registers the differential test lets LDH and LD (C) touch
+static const u8 diff_io[] = {0x04, 0x05, 0x06, 0x07, 0x0F, 0x80, 0x90, 0xA0, 0xC0, 0xFE, 0xFF};
+
+typedef struct {
+    cpu_context cpu;
+    timer_context timer;
+    u64 ticks;
+    u8 mem[DIFF_SIZE];
+    u8 hram[0x7F];
+} diff_state;
+
+static u32 diff_seed = 0x12345678;
+
+static u32 diff_rand() {
+    diff_seed ^= diff_seed << 13;
+    diff_seed ^= diff_seed >> 17;
+    diff_seed ^= diff_seed << 5;
+    return diff_seed;
+}
+
+static void diff_save(diff_state *s) {
+    // Compare evaluated flags, not how each engine recorded them
+    cpu_get_f(&gb->cpu);
+    s->cpu = gb->cpu;
+    timer_sync(gb);
+    s->timer = gb->timer;
+    s->ticks = gb->emu.ticks;
+
+    for (int i = 0; i < DIFF_SIZE; i++) {
+        s->mem[i] = bus_read(gb, DIFF_BASE + i);
+    }
+
+    for (int i = 0; i < 0x7F; i++) {
+        s->hram[i] = bus_read(gb, 0xFF80 + i);
+    }
+}
+
+static void diff_load(const diff_state *s) {
+    gb->cpu = s->cpu;
+    gb->timer = s->timer;
+    timer_reschedule(gb);
+    gb->emu.ticks = s->ticks;
+
+    for (int i = 0; i < DIFF_SIZE; i++) {
+        bus_write(gb, DIFF_BASE + i, s->mem[i]);
+    }
+
+    for (int i = 0; i < 0x7F; i++) {
+        bus_write(gb, 0xFF80 + i, s->hram[i]);
+    }
+}
+
+// Builds a random machine state that executes opcode (0x1XX for CB XX) at 0xC100
+static void diff_setup(u16 opcode) {
+    memset(&gb->cpu, 0, sizeof(gb->cpu));
+    gb->cpu.regs.a = diff_rand();
+    gb->cpu.regs.f = diff_rand() & 0xF0;
+    gb->cpu.regs.b = 0xC0 | (diff_rand() & 1);
+    gb->cpu.regs.c = diff_io[diff_rand() % sizeof(diff_io)];
+    gb->cpu.regs.d = 0xC0 | (diff_rand() & 1);
+    gb->cpu.regs.e = diff_rand();
+    gb->cpu.regs.h = 0xC0 | (diff_rand() & 1);
+    gb->cpu.regs.l = 2 + diff_rand() % 0xFC;
+    // Keeps SP inside the window after ADD SP,e and an interrupt push
+    gb->cpu.regs.sp = DIFF_BASE + 0x82 + diff_rand() % 0xFC;
+    gb->cpu.regs.pc = 0xC100;
+    gb->cpu.interrupt_master_enabled = diff_rand() & 1;
+    gb->cpu.enabling_ime = diff_rand() & 1;
+    gb->cpu.ie_register = diff_rand() & 0x1F;
+    gb->cpu.int_flags = diff_rand() & 0x1F;
+    cpu_update_int_pending(&gb->cpu);
+
+    timer_context *timer = &gb->timer;
+    timer->div = diff_rand();
+    timer->tima = diff_rand();
+    timer->tma = diff_rand();
+    timer->tac = diff_rand() & 0x07;
+    timer->ticks = gb->emu.ticks;
+    timer_reschedule(gb);
+
+    for (int i = 0; i < DIFF_SIZE; i++) {
+        bus_write(gb, DIFF_BASE + i, diff_rand());
+    }
+
+    for (int i = 0; i < 0x7F; i++) {
+        bus_write(gb, 0xFF80 + i, diff_rand());
+    }
+
+    u8 op = opcode & 0xFF;
+    u8 n1 = diff_rand();
+    u8 n2 = diff_rand();
+
+    if (opcode & 0x100) {
+        // CB prefix
+        n1 = op;
+        op = 0xCB;
+    } else if (op == 0xE0 || op == 0xF0) {
+        // LDH (n),A / LDH A,(n)
+        n1 = diff_io[diff_rand() % sizeof(diff_io)];
+    } else if (op == 0x31) {
+        // LD SP,nn
+        n1 = 2 + diff_rand() % 0xFC;
+        n2 = 0xC0 | (diff_rand() & 1);
+    } else if (op == 0x08 || op == 0xEA || op == 0xFA) {
+        // LD (nn),SP / LD (nn),A / LD A,(nn)
+        n1 = diff_rand() & 0xFD;
+        n2 = 0xC0 | (diff_rand() & 1);
+    }
+
+    bus_write(gb, 0xC100, op);
+    bus_write(gb, 0xC101, n1);
+    bus_write(gb, 0xC102, n2);
+}
+
+// Checks that two machine states match
+static bool diff_equal(const diff_state *a, const diff_state *b) {
+    return memcmp(&a->cpu.regs, &b->cpu.regs, sizeof(cpu_registers)) == 0 &&
+        a->cpu.halted == b->cpu.halted &&
+        a->cpu.interrupt_master_enabled == b->cpu.interrupt_master_enabled &&
+        a->cpu.enabling_ime == b->cpu.enabling_ime &&
+        a->cpu.ie_register == b->cpu.ie_register &&
+        a->cpu.int_flags == b->cpu.int_flags &&
+        memcmp(&a->timer, &b->timer, sizeof(timer_context)) == 0 &&
+        a->ticks == b->ticks &&
+        memcmp(a->mem, b->mem, DIFF_SIZE) == 0 &&
+        memcmp(a->hram, b->hram, 0x7F) == 0;
+}
+
+// Runs every opcode from random states through both dispatch engines
+START_TEST(test_dispatch_differential) {
+    // Registers the timer and IF with the IO table
+    timer_init(gb);
+    cpu_init(gb);
+
+    for (u16 opcode = 0; opcode < 0x200; opcode++) {
+        // The CB prefix itself and unused opcodes are not executable
+        if (opcode == 0xCB) {
+            continue;
+        }
+
+        if (opcode < 0x100 && instruction_by_opcode(opcode)->type == IN_NONE) {
+            continue;
+        }
+
+        for (int trial = 0; trial < 64; trial++) {
+            diff_state start, table, handlers;
+
+            diff_setup(opcode);
+            diff_save(&start);
+
+            cpu_set_dispatch(gb, DISPATCH_TABLE);
+            cpu_step(gb);
+            diff_save(&table);
+
+            diff_load(&start);
+            cpu_set_dispatch(gb, DISPATCH_HANDLERS);
+            cpu_step(gb);
+            diff_save(&handlers);
+
+            ck_assert_msg(diff_equal(&table, &handlers),
+                "Dispatch engines differ for opcode %03X (trial %d)", opcode, trial);
+        }
+    }
+} END_TEST
+
+// Packs a result and its flags the way the ALU tables do
+static u16 ref_entry(int r, bool z, bool n, bool h, bool c) {
+    return (r & 0xFF) | (z << 15) | (n << 14) | (h << 13) | (c << 12);
+}
+
+// The arithmetic the interpreter used before the ALU tables
+static u16 ref_shift(int op, u8 v, bool flag_c) {
+    u8 r;
+    bool c;
+
+    switch (op) {
+    case 0: r = (v << 1) | (v >> 7); c = v >> 7; break;
+    case 1: r = (v >> 1) | (v << 7); c = v & 1; break;
+    case 2: r = (v << 1) | flag_c; c = !!(v & 0x80); break;
+    case 3: r = (v >> 1) | (flag_c << 7); c = v & 1; break;
+    case 4: r = v << 1; c = !!(v & 0x80); break;
+    case 5: r = (int8_t)v >> 1; c = v & 1; break;
+    case 6: r = ((v & 0xF0) >> 4) | ((v & 0xF) << 4); c = false; break;
+    default: r = v >> 1; c = v & 1; break;
+    }
+
+    return ref_entry(r, r == 0, 0, 0, c);
+}
+
+static u16 ref_daa(u8 a, bool n, bool h, bool c) {
+    u8 u = 0;
+    int cf = 0;
+
+    if (h || (!n && (a & 0xF) > 9)) {
+        u = 6;
+    }
+
+    if (c || (!n && a > 0x99)) {
+        u |= 0x60;
+        cf = 1;
+    }
+
+    a += n ? -u : u;
+    return ref_entry(a, a == 0, n, 0, cf);
+}
+
+// Checks every ALU table entry against the arithmetic it replaces
+START_TEST(test_alu_tables) {
+    alu_init();
+
+    for (int c = 0; c < 2; c++) {
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                u16 add = ref_entry(a + b + c, ((a + b + c) & 0xFF) == 0, 0,
+                                    (a & 0xF) + (b & 0xF) + c > 0xF, a + b + c > 0xFF);
+                u16 sub = ref_entry(a - b - c, (u8)(a - (u8)(b + c)) == 0, 1,
+                                    (a & 0xF) - (b & 0xF) - c < 0, a - b - c < 0);
+
+                ck_assert_msg(alu_add_table[c][a][b] == add, "ADC %02X,%02X,%d", a, b, c);
+                ck_assert_msg(alu_sub_table[c][a][b] == sub, "SBC %02X,%02X,%d", a, b, c);
+            }
+        }
+    }
+
+    for (int v = 0; v < 256; v++) {
+        u8 inc = v + 1;
+        u8 dec = v - 1;
+
+        ck_assert_int_eq(alu_inc_table[v], ref_entry(inc, inc == 0, 0, (inc & 0x0F) == 0, 0));
+        ck_assert_int_eq(alu_dec_table[v], ref_entry(dec, dec == 0, 1, (dec & 0x0F) == 0x0F, 0));
+
+        for (int nhc = 0; nhc < 8; nhc++) {
+            ck_assert_msg(alu_daa_table[nhc][v] == ref_daa(v, nhc & 4, nhc & 2, nhc & 1),
+                "DAA %02X with NHC %d", v, nhc);
+        }
+
+        for (int op = 0; op < 8; op++) {
+            for (int c = 0; c < 2; c++) {
+                ck_assert_msg(alu_shift_table[op][c][v] == ref_shift(op, v, c),
+                    "CB op %d on %02X with carry %d", op, v, c);
+            }
+        }
+    }
+} END_TEST
+
+// 8-bit registers and their pairs must alias on any host
+START_TEST(test_register_pairs) {
+    cpu_set_reg(&gb->cpu, RT_BC, 0x1234);
+    ck_assert_int_eq(gb->cpu.regs.b, 0x12);
+    ck_assert_int_eq(gb->cpu.regs.c, 0x34);
+
+    gb->cpu.regs.h = 0xAB;
+    gb->cpu.regs.l = 0xCD;
+    ck_assert_int_eq(gb->cpu.regs.hl, 0xABCD);
+    ck_assert_int_eq(cpu_read_reg(&gb->cpu, RT_HL), 0xABCD);
+
+    cpu_set_reg8(&gb->cpu, RT_D, 0x56);
+    cpu_set_reg8(&gb->cpu, RT_E, 0x78);
+    ck_assert_int_eq(cpu_read_reg(&gb->cpu, RT_DE), 0x5678);
+
+    cpu_set_reg(&gb->cpu, RT_AF, 0x9AB0);
+    ck_assert_int_eq(cpu_read_reg8(&gb->cpu, RT_A), 0x9A);
+    ck_assert_int_eq(cpu_read_reg8(&gb->cpu, RT_F), 0xB0);
+
+    cpu_init(gb);
+    ck_assert_int_eq(gb->cpu.regs.a, 0x01);
+    ck_assert_int_eq(gb->cpu.regs.f, 0xB0);
+    ck_assert_int_eq(gb->cpu.regs.c, 0x13);
+    ck_assert_int_eq(gb->cpu.regs.l, 0x4D);
+} END_TEST
+
+// Work RAM and high RAM contents right after a cartridge is loaded
+static u8 boot_wram[0x2000];
+static u8 boot_hram[0x7F];
+
+// Puts the machine back into its power-on state
+static void reset_machine() {
+    memset(&gb->cpu, 0, sizeof(gb->cpu));
+    memset(&gb->timer, 0, sizeof(timer_context));
+    ram_init(gb);
+    timer_init(gb);
+    cpu_init(gb);
+    gb->emu.ticks = 0;
+    idle_reset(gb);
+
+    for (int i = 0; i < 0x2000; i++) {
+        bus_write(gb, 0xC000 + i, boot_wram[i]);
+    }
+
+    for (int i = 0; i < 0x7F; i++) {
+        bus_write(gb, 0xFF80 + i, boot_hram[i]);
+    }
+
+    bus_write(gb, 0xFF01, 0);
+    bus_write(gb, 0xFF02, 0);
+}
+
+// Loads a ROM and snapshots the memory reset_machine() restores
+static void load_rom(char *rom) {
+    ck_assert(cart_load(gb, rom));
+
+    for (int i = 0; i < 0x2000; i++) {
+        boot_wram[i] = bus_read(gb, 0xC000 + i);
+    }
+
+    for (int i = 0; i < 0x7F; i++) {
+        boot_hram[i] = bus_read(gb, 0xFF80 + i);
+    }
+}
+
+// Runs the loaded ROM for the given number of steps with the block cache,
+// then runs the table path for the same number of cycles and compares the two
+static bool blocks_match_table(int steps) {
+    diff_state blocks, table;
+
+    reset_machine();
+    cpu_set_dispatch(gb, DISPATCH_BLOCKS);
+
+    for (int i = 0; i < steps; i++) {
+        cpu_step(gb);
+    }
+
+    diff_save(&blocks);
+    u64 ticks = blocks.ticks;
+
+    reset_machine();
+    cpu_set_dispatch(gb, DISPATCH_TABLE);
+
+    while (gb->emu.ticks < ticks) {
+        cpu_step(gb);
+    }
+
+    diff_save(&table);
+
+    if (!diff_equal(&blocks, &table)) {
+        printf("Block cache and table path differ at PC %04X / %04X\n",
+            blocks.cpu.regs.pc, table.cpu.regs.pc);
+        return false;
+    }
+
+    return true;
+}
+
+START_TEST(test_block_cache_matches_table) {
+    load_rom(ROM_DIR "/06-ld r,r.gb");
+    ck_assert(blocks_match_table(50000));
+} END_TEST
+
+// A WRAM copy loop made of fused sequences (see fused_ops). The timer vector
+// returns with RET, so the outer loop enables interrupts again.
+static const u8 fused_loop[] = {
+    0xFB,             // C000: EI
+    0x21, 0x00, 0xC1, // LD HL,C100
+    0x11, 0x00, 0xC2, // LD DE,C200
+    0x06, 0x40,       // LD B,40
+    0x2A,             // C009: LD A,(HL+)
+    0x12,             // LD (DE),A
+    0x13,             // INC DE
+    0x05,             // DEC B
+    0x20, 0xFA,       // JR NZ,C009
+    0x18, 0xEF,       // JR C000
+};
+
+// Starts the copy loop with the timer interrupt firing every 1024 cycles, so
+// interrupts also land between the opcodes of fused sequences
+static void start_fused_loop(cpu_dispatch dispatch) {
+    reset_machine();
+
+    for (int i = 0; i < sizeof(fused_loop); i++) {
+        bus_write(gb, 0xC000 + i, fused_loop[i]);
+    }
+
+    gb->cpu.regs.pc = 0xC000;
+    cpu_set_ie_register(gb, INT_TIMER);
+    timer_write(gb, 0xFF07, 0x05);
+    cpu_set_dispatch(gb, dispatch);
+}
+
+START_TEST(test_fused_matches_table) {
+    // The timer vector of this ROM is INC A; RET
+    load_rom(ROM_DIR "/02-interrupts.gb");
+
+    diff_state blocks, table;
+
+    start_fused_loop(DISPATCH_BLOCKS);
+
+    for (int i = 0; i < 20000; i++) {
+        cpu_step(gb);
+    }
+
+    // The loop body and its counter run as two fused handlers
+    code_block *b = block_lookup(gb, 0xC009);
+    ck_assert(b && b->instrs[0].fused == 2 && b->instrs[3].fused == 1);
+
+    diff_save(&blocks);
+
+    start_fused_loop(DISPATCH_TABLE);
+
+    while (gb->emu.ticks < blocks.ticks) {
+        cpu_step(gb);
+    }
+
+    diff_save(&table);
+    ck_assert(diff_equal(&blocks, &table));
+} END_TEST
+
+// timer_skip must leave the timer exactly as ticking it one by one would
+START_TEST(test_page_table) {
+    load_rom(ROM_DIR "/01-special.gb");
+    reset_machine();
+
+    for (u32 a = 0; a < 0x8000; a += 0x7F) {
+        ck_assert(bus_read(gb, a) == cart_read(gb, a));
+    }
+
+    // WRAM is written directly until a block is decoded from it
+    ck_assert(gb->bus.write_pages[0xC1] != NULL);
+    bus_write(gb, 0xC100, 0x00); // NOP
+    bus_write(gb, 0xC101, 0x18); // JR C100
+    bus_write(gb, 0xC102, 0xFD);
+    ck_assert(bus_read(gb, 0xC101) == 0x18);
+
+    u32 gen = gb->block.gen;
+    ck_assert(block_lookup(gb, 0xC100) != NULL);
+    ck_assert(gb->bus.write_pages[0xC1] == NULL && gb->bus.write_pages[0xC2] != NULL);
+
+    // Writing code in a protected page still invalidates it and unprotects
+    bus_write(gb, 0xC100, 0x3C);
+    ck_assert(gb->block.gen != gen && bus_read(gb, 0xC100) == 0x3C);
+    ck_assert(gb->bus.write_pages[0xC1] != NULL);
+} END_TEST
+
+static u8 io_test_value;
+
+static u8 io_test_read(gb_t *gb, u16 address) {
+    return io_test_value;
+}
+
+static void io_test_write(gb_t *gb, u16 address, u8 value) {
+    io_test_value = value + (address & 0xFF);
+}
+
+START_TEST(test_io_table) {
+    reset_machine();
+
+    // Unused IF bits read as 1
+    cpu_set_int_flags(gb, INT_TIMER);
+    ck_assert(bus_read(gb, 0xFF0F) == 0xE4);
+
+    io_register(gb, 0xFF70, 2, io_test_read, io_test_write, 0x80);
+    bus_write(gb, 0xFF71, 0x10);
+    ck_assert(io_test_value == 0x81);
+    ck_assert(bus_read(gb, 0xFF70) == 0x81);
+    io_test_value = 0x05;
+    ck_assert(bus_read(gb, 0xFF71) == 0x85);
+
+    io_register(gb, 0xFF70, 2, NULL, NULL, 0);
+    ck_assert(bus_read(gb, 0xFF70) == 0);
+} END_TEST
+
+START_TEST(test_timer_skip) {
+    timer_context *timer = &gb->timer;
+
+    for (int trial = 0; trial < 2000; trial++) {
+        timer_context start = {.div = diff_rand(), .tima = diff_rand(), .tma = diff_rand(), .tac = diff_rand() & 0x07};
+        u32 ticks = diff_rand() % 5000;
+
+        *timer = start;
+        cpu_set_int_flags(gb, 0);
+
+        for (u32 i = 0; i < ticks; i++) {
+            timer_tick(gb);
+        }
+
+        timer_context ticked = *timer;
+        u8 ticked_if = cpu_get_int_flags(gb);
+
+        *timer = start;
+        cpu_set_int_flags(gb, 0);
+        timer_skip(gb, ticks);
+
+        ck_assert_msg(!memcmp(timer, &ticked, sizeof(ticked)) && cpu_get_int_flags(gb) == ticked_if,
+            "timer_skip(gb, %u) differs from ticking (trial %d)", ticks, trial);
+    }
+} END_TEST
+
+START_TEST(test_timer_reads) {
+    timer_context *timer = &gb->timer;
+    emu_context *emu = &gb->emu;
+
+    reset_machine();
+
+    for (int trial = 0; trial < 2000; trial++) {
+        timer_context start = {.ticks = emu->ticks, .div = diff_rand(), .tima = diff_rand(),
+            .tma = diff_rand(), .tac = diff_rand() & 0x07};
+        u32 cycles = diff_rand() % 2000;
+
+        *timer = start;
+        cpu_set_int_flags(gb, 0);
+
+        for (u32 i = 0; i < cycles * 4; i++) {
+            timer_tick(gb);
+        }
+
+        u8 div = timer->div >> 8;
+        u8 tima = timer->tima;
+        u8 ticked_if = cpu_get_int_flags(gb);
+
+        *timer = start;
+        timer_reschedule(gb);
+        cpu_set_int_flags(gb, 0);
+        emu_cycles(gb, cycles);
+
+        ck_assert_msg(timer_read(gb, 0xFF04) == div && timer_read(gb, 0xFF05) == tima && cpu_get_int_flags(gb) == ticked_if,
+            "timer reads differ from ticking after %u M-cycles (trial %d)", cycles, trial);
+    }
+
+    // Resetting DIV while the selected bit is set is a falling edge
+    *timer = (timer_context){.ticks = emu->ticks, .div = 0x0200, .tima = 0x10, .tac = 0x04};
+    timer_write(gb, 0xFF04, 0);
+    ck_assert(timer_read(gb, 0xFF05) == 0x11 && timer_read(gb, 0xFF04) == 0);
+
+    // So is switching from a set bit to a clear one, or disabling the timer
+    *timer = (timer_context){.ticks = emu->ticks, .div = 0x0008, .tima = 0x10, .tac = 0x05};
+    timer_write(gb, 0xFF07, 0x04);
+    ck_assert(timer_read(gb, 0xFF05) == 0x11);
+    timer_write(gb, 0xFF07, 0x00);
+    ck_assert(timer_read(gb, 0xFF05) == 0x11);
+
+    timer_write(gb, 0xFF07, 0x05);
+    timer_write(gb, 0xFF07, 0x01);
+    ck_assert(timer_read(gb, 0xFF05) == 0x12);
+} END_TEST
+
+START_TEST(test_halt_skip) {
+    timer_context *timer = &gb->timer;
+    emu_context *emu = &gb->emu;
+
+    reset_machine();
+
+    for (int trial = 0; trial < 500; trial++) {
+        timer_context start = {.ticks = emu->ticks, .div = diff_rand(), .tima = diff_rand(),
+            .tma = diff_rand(), .tac = diff_rand() & 0x07};
+
+        // One tick at a time, checking IF after every M-cycle
+        *timer = start;
+        cpu_set_int_flags(gb, 0);
+        u64 cycles = 0;
+
+        do {
+            for (int i = 0; i < 4; i++) {
+                timer_tick(gb);
+            }
+
+            cycles++;
+        } while (!cpu_get_int_flags(gb) && cycles < TICKS_PER_FRAME / 4);
+
+        timer_context ticked = *timer;
+        ticked.ticks += cycles * 4;
+        u8 ticked_if = cpu_get_int_flags(gb);
+
+        *timer = start;
+        timer_reschedule(gb);
+        cpu_set_int_flags(gb, 0);
+        gb->cpu.halted = true;
+        u64 ticks = emu->ticks;
+        cpu_step(gb);
+        timer_sync(gb);
+
+        ck_assert_msg(emu->ticks - ticks == cycles * 4, "halted for %llu ticks instead of %llu (trial %d)",
+            (unsigned long long)(emu->ticks - ticks), (unsigned long long)cycles * 4, trial);
+        ck_assert_msg(!memcmp(timer, &ticked, sizeof(ticked)) && cpu_get_int_flags(gb) == ticked_if,
+            "timer differs after HALT (trial %d)", trial);
+        ck_assert(gb->cpu.halted == !ticked_if);
+    }
+} END_TEST
+
+START_TEST(test_interrupt_dispatch) {
+    emu_context *emu = &gb->emu;
+
+    reset_machine();
+
+    for (int ie = 0; ie < 0x20; ie++) {
+        for (int iflags = 0; iflags < 0x20; iflags++) {
+            gb->cpu.regs.pc = 0x1234;
+            gb->cpu.regs.sp = 0xDFFE;
+            gb->cpu.interrupt_master_enabled = true;
+            cpu_set_ie_register(gb, ie);
+            cpu_set_int_flags(gb, iflags);
+            u64 ticks = emu->ticks;
+
+            cpu_handle_interrupts(&gb->cpu);
+
+            if (!(ie & iflags)) {
+                ck_assert(gb->cpu.regs.pc == 0x1234 && gb->cpu.interrupt_master_enabled && emu->ticks == ticks);
+                continue;
+            }
+
+            int bit = 0;
+
+            while (!(ie & iflags & (1 << bit))) {
+                bit++;
+            }
+
+            ck_assert_msg(gb->cpu.regs.pc == 0x40 + bit * 8, "IE %02X IF %02X jumped to %04X", ie, iflags, gb->cpu.regs.pc);
+            ck_assert(gb->cpu.int_flags == (iflags & ~(1 << bit)));
+            ck_assert(gb->cpu.int_pending == (gb->cpu.int_flags & ie));
+            ck_assert(!gb->cpu.interrupt_master_enabled && gb->cpu.regs.sp == 0xDFFC);
+            ck_assert(bus_read(gb, 0xDFFC) == 0x34 && bus_read(gb, 0xDFFD) == 0x12);
+            ck_assert(emu->ticks - ticks == 5 * 4);
+        }
+    }
+} END_TEST
+
+// Waits for the timer interrupt flag, then for DIV to reach 0x80, forever
+static const u8 idle_loops[] = {
+    0xF0, 0x0F,       // C000: LDH A,(0F)
+    0xE6, 0x04,       // AND 04
+    0x28, 0xFA,       // JR Z,C000
+    0xAF,             // XOR A
+    0xE0, 0x0F,       // LDH (0F),A
+    0xF0, 0x04,       // C009: LDH A,(04)
+    0xFE, 0x80,       // CP 80
+    0x20, 0xFA,       // JR NZ,C009
+    0x18, 0xEF,       // JR C000
+};
+
+static void start_idle_loops(cpu_dispatch dispatch) {
+    reset_machine();
+
+    for (int i = 0; i < sizeof(idle_loops); i++) {
+        bus_write(gb, 0xC000 + i, idle_loops[i]);
+    }
+
+    gb->cpu.regs.pc = 0xC000;
+    timer_write(gb, 0xFF07, 0x04);
+    cpu_set_dispatch(gb, dispatch);
+}
+
+START_TEST(test_idle_matches_table) {
+    load_rom(ROM_DIR "/02-interrupts.gb");
+
+    diff_state blocks, table;
+
+    start_idle_loops(DISPATCH_BLOCKS);
+    gb->idle.skipped_ticks = 0;
+
+    for (int i = 0; i < 20000; i++) {
+        cpu_step(gb);
+    }
+
+    ck_assert(block_lookup(gb, 0xC000)->idle & IDLE_READS_IF);
+    ck_assert(block_lookup(gb, 0xC009)->idle & IDLE_READS_DIV);
+    ck_assert(gb->idle.skipped_ticks > 0);
+
+    diff_save(&blocks);
+
+    start_idle_loops(DISPATCH_TABLE);
+
+    while (gb->emu.ticks < blocks.ticks) {
+        cpu_step(gb);
+    }
+
+    diff_save(&table);
+    ck_assert(diff_equal(&blocks, &table));
+} END_TEST
+
+#ifdef GBEMU_JIT
+START_TEST(test_jit_matches_table) {
+    load_rom(ROM_DIR "/09-op r,r.gb");
+    ck_assert(blocks_match_table(500000));
+
+    // The loop the CPU is in should have been recompiled by now
+    cpu_set_dispatch(gb, DISPATCH_BLOCKS);
+
+    for (int i = 0; i < 1000; i++) {
+        cpu_step(gb);
+    }
+
+    code_block *b = block_lookup(gb, gb->cpu.regs.pc);
+    ck_assert(b && b->native);
+} END_TEST
+#endif
+
+// Writes a cartridge of the given type in which every bank holds its number
+// at offset 0x2000
+static void write_banked_rom(const char *path, u8 type, u32 banks, u8 ram_code) {
+    static u8 bank[0x4000];
+    FILE *fp = fopen(path, "wb");
+    ck_assert(fp);
+
+    for (u32 i = 0; i < banks; i++) {
+        memset(bank, 0, sizeof(bank));
+        bank[0x2000] = i;
+        bank[0x2001] = i >> 8;
+
+        if (i == 0) {
+            u8 size_code = 0;
+
+            while ((2u << size_code) < banks) {
+                size_code++;
+            }
+
+            bank[0x147] = type;
+            bank[0x148] = size_code;
+            bank[0x149] = ram_code;
+        }
+
+        fwrite(bank, sizeof(bank), 1, fp);
+    }
+
+    fclose(fp);
+}
+
+START_TEST(test_mbc_banking) {
+    // MBC1+RAM, 1MB ROM, 32KB RAM
+    write_banked_rom("mbc_test.gb", 0x02, 64, 3);
+    ck_assert(cart_load(gb, "mbc_test.gb"));
+
+    ck_assert(bus_read(gb, 0x6000) == 1 && bus_read(gb, 0x2000) == 0);
+    bus_write(gb, 0x2000, 0x00);
+    ck_assert(bus_read(gb, 0x6000) == 1);
+
+    u32 gen = gb->block.gen;
+    bus_write(gb, 0x2000, 0x05);
+    ck_assert(bus_read(gb, 0x6000) == 0x05 && cart_rom_bank(gb) == 0x05 && gb->block.gen != gen);
+    bus_write(gb, 0x4000, 0x01);
+    ck_assert(bus_read(gb, 0x6000) == 0x25 && bus_read(gb, 0x2000) == 0);
+
+    // Mode 1 also switches the bank at 0x0000 and the RAM bank
+    bus_write(gb, 0x6000, 0x01);
+    ck_assert(bus_read(gb, 0x2000) == 0x20 && cart_rom_bank0(gb) == 0x20);
+
+    ck_assert(bus_read(gb, 0xA000) == 0xFF);
+    bus_write(gb, 0x0000, 0x0A);
+    bus_write(gb, 0xA000, 0x42);
+    bus_write(gb, 0x4000, 0x02);
+    ck_assert(bus_read(gb, 0xA000) == 0x00);
+    bus_write(gb, 0x4000, 0x01);
+    ck_assert(bus_read(gb, 0xA000) == 0x42);
+    bus_write(gb, 0x0000, 0x00);
+    ck_assert(bus_read(gb, 0xA000) == 0xFF);
+
+    // MBC5+RAM, 8MB ROM, bank 0 can be mapped at 0x4000
+    write_banked_rom("mbc_test.gb", 0x1A, 512, 4);
+    ck_assert(cart_load(gb, "mbc_test.gb"));
+
+    bus_write(gb, 0x2000, 0x34);
+    bus_write(gb, 0x3000, 0x01);
+    ck_assert(bus_read(gb, 0x6000) == 0x34 && bus_read(gb, 0x6001) == 0x01);
+    bus_write(gb, 0x2000, 0x00);
+    bus_write(gb, 0x3000, 0x00);
+    ck_assert(bus_read(gb, 0x6000) == 0x00 && bus_read(gb, 0x6001) == 0x00);
+
+    // MBC2, 256KB ROM, 512 x 4 bits of RAM mirrored through 0xA000 - 0xBFFF
+    write_banked_rom("mbc_test.gb", 0x05, 16, 0);
+    ck_assert(cart_load(gb, "mbc_test.gb"));
+
+    bus_write(gb, 0x2100, 0x03);
+    ck_assert(bus_read(gb, 0x6000) == 0x03);
+    bus_write(gb, 0x0000, 0x0A);
+    bus_write(gb, 0xA000, 0xAB);
+    ck_assert(bus_read(gb, 0xA000) == 0xFB && bus_read(gb, 0xA200) == 0xFB);
+
+    remove("mbc_test.gb");
+} END_TEST
+
+START_TEST(test_rom_image) {
+    // A full 16 character title runs into the CGB flag, which must survive
+    write_banked_rom("rom_test.gb", 0x00, 2, 0);
+    FILE *fp = fopen("rom_test.gb", "r+b");
+    ck_assert(fp);
+    fseek(fp, 0x134, SEEK_SET);
+    fwrite("ABCDEFGHIJKLMNO\x80", 16, 1, fp);
+    fclose(fp);
+
+    ck_assert(cart_load(gb, "rom_test.gb"));
+    ck_assert(cart_rom_data(gb)[0x143] == 0x80 && bus_read(gb, 0x143) == 0x80);
+    ck_assert(bus_read(gb, 0x6000) == 0x01);
+
+    // A truncated image is padded to whole banks
+    truncate("rom_test.gb", 0x150);
+    ck_assert(cart_load(gb, "rom_test.gb"));
+    ck_assert(cart_rom_size(gb) == 0x150);
+    ck_assert(bus_read(gb, 0x143) == 0x80 && bus_read(gb, 0x2000) == 0 && bus_read(gb, 0x7FFF) == 0);
+
+    remove("rom_test.gb");
+} END_TEST
+
+START_TEST(test_battery_save) {
+    // MBC1+RAM+BATTERY, 32KB RAM backed by save_test.sav
+    remove("save_test.sav");
+    write_banked_rom("save_test.gb", 0x03, 4, 3);
+    ck_assert(cart_load(gb, "save_test.gb"));
+
+    struct stat st;
+    ck_assert(stat("save_test.sav", &st) == 0 && st.st_size == 0x8000);
+
+    // Enabling RAM schedules a flush at the next frame boundary
+    bus_write(gb, 0x0000, 0x0A);
+    ck_assert(gb->sched.deadline % TICKS_PER_FRAME == 0);
+    bus_write(gb, 0x6000, 0x01);
+    bus_write(gb, 0x4000, 0x02);
+    bus_write(gb, 0xA010, 0x42);
+    bus_write(gb, 0x0000, 0x00);
+    ck_assert(gb->sched.deadline == UINT64_MAX);
+
+    FILE *fp = fopen("save_test.sav", "rb");
+    ck_assert(fp);
+    fseek(fp, 0x4010, SEEK_SET);
+    ck_assert(fgetc(fp) == 0x42);
+    fclose(fp);
+
+    // The save is loaded back with the cartridge
+    ck_assert(cart_load(gb, "save_test.gb"));
+    bus_write(gb, 0x0000, 0x0A);
+    bus_write(gb, 0x6000, 0x01);
+    bus_write(gb, 0x4000, 0x02);
+    ck_assert(bus_read(gb, 0xA010) == 0x42);
+    bus_write(gb, 0x0000, 0x00);
+
+    remove("save_test.gb");
+    remove("save_test.sav");
+} END_TEST
+
+static void rtc_latch_regs(u8 *regs) {
+    bus_write(gb, 0x6000, 0x00);
+    bus_write(gb, 0x6000, 0x01);
+
+    for (int i = 0; i < 5; i++) {
+        bus_write(gb, 0x4000, 0x08 + i);
+        regs[i] = bus_read(gb, 0xA000);
+    }
+}
+
+START_TEST(test_mbc3_rtc) {
+    // MBC3+TIMER+BATTERY, the clock state is the whole save file
+    remove("rtc_test.sav");
+    write_banked_rom("rtc_test.gb", 0x0F, 4, 0);
+    ck_assert(cart_load(gb, "rtc_test.gb"));
+
+    u8 regs[5];
+
+    // 23:59:59 on day 511, one second before the day counter overflows
+    static const u8 start[5] = {59, 59, 23, 0xFF, 0x01};
+    bus_write(gb, 0x0000, 0x0A);
+
+    for (int i = 0; i < 5; i++) {
+        bus_write(gb, 0x4000, 0x08 + i);
+        bus_write(gb, 0xA000, start[i]);
+    }
+
+    // Only a latch updates what the game reads
+    emu_skip(gb, 4194304);
+    bus_write(gb, 0x4000, 0x08);
+    ck_assert(bus_read(gb, 0xA000) == 0);
+
+    rtc_latch_regs(regs);
+    ck_assert(regs[0] == 0 && regs[1] == 0 && regs[2] == 0 && regs[3] == 0 && regs[4] == 0x80);
+
+    // Days pass in closed form, a halted clock stands still
+    emu_skip(gb, 4194304u * 100);
+    rtc_latch_regs(regs);
+    ck_assert(regs[0] == 40 && regs[1] == 1 && regs[2] == 0);
+
+    bus_write(gb, 0x4000, 0x0C);
+    bus_write(gb, 0xA000, 0x40);
+    emu_skip(gb, 4194304u * 5);
+    rtc_latch_regs(regs);
+    ck_assert(regs[0] == 40 && regs[4] == 0x40);
+
+    // Out of range seconds count to 63 and wrap without a carry
+    bus_write(gb, 0x4000, 0x08);
+    bus_write(gb, 0xA000, 62);
+    bus_write(gb, 0x4000, 0x0C);
+    bus_write(gb, 0xA000, 0x00);
+    emu_skip(gb, 4194304u * 2);
+    rtc_latch_regs(regs);
+    ck_assert(regs[0] == 0 && regs[1] == 1);
+
+    // Disabling RAM stores the clock, loading the save brings it back
+    bus_write(gb, 0x0000, 0x00);
+    ck_assert(cart_load(gb, "rtc_test.gb"));
+    bus_write(gb, 0x0000, 0x0A);
+    bus_write(gb, 0x4000, 0x09);
+    ck_assert(bus_read(gb, 0xA000) == 1);
+
+    bus_write(gb, 0x0000, 0x00);
+
+    remove("rtc_test.gb");
+    remove("rtc_test.sav");
+} END_TEST
+
+START_TEST(test_aot_matches_table) {
+    load_rom(ROM_DIR "/09-op r,r.gb");
+
+    mkdir("aot_test", 0755);
+    ck_assert(aot_compile(gb, "aot_test"));
+    ck_assert(aot_load(gb, "aot_test"));
+
+    // The entry point is always found by the static pass
+    code_block *b = block_lookup(gb, 0x100);
+    ck_assert(b && b->native && b->native == aot_lookup(gb, 0, 0x100));
+
+    ck_assert(blocks_match_table(500000));
+    aot_unload(gb);
+} END_TEST
+
+START_TEST(test_aot_region_straddle) {
+    // JP 0x3FFC; NOP; NOP; LD BC,d16 across 0x4000; NOP; JR -2
+    static const u8 entry[] = {0xC3, 0xFC, 0x3F};
+    static const u8 code[] = {0x00, 0x00, 0x01, 0x34, 0x12, 0x00, 0x18, 0xFE};
+
+    write_banked_rom("aot_straddle.gb", 0x00, 2, 0);
+
+    FILE *fp = fopen("aot_straddle.gb", "r+b");
+    ck_assert(fp);
+    fseek(fp, 0x100, SEEK_SET);
+    fwrite(entry, sizeof(entry), 1, fp);
+    fseek(fp, 0x3FFC, SEEK_SET);
+    fwrite(code, sizeof(code), 1, fp);
+    fclose(fp);
+
+    ck_assert(cart_load(gb, "aot_straddle.gb"));
+
+    mkdir("aot_test", 0755);
+    ck_assert(aot_compile(gb, "aot_test"));
+    ck_assert(aot_load(gb, "aot_test"));
+
+    // The straddling instruction is left to the interpreter, the code after it is not
+    ck_assert(aot_lookup(gb, 0, 0x3FFC));
+    ck_assert(!aot_lookup(gb, 0, 0x3FFE));
+    ck_assert(aot_lookup(gb, 1, 0x4001));
+
+    aot_unload(gb);
+    remove("aot_straddle.gb");
+} END_TEST
+
+// Runs a ROM for a number of steps on an instance of its own
+typedef struct {
+    const char *rom;
+    int steps;
+    gb_t *gb;
+} instance_run;
+
+static void *run_instance(void *p) {
+    instance_run *run = p;
+
+    run->gb = gb_create();
+
+    if (!run->gb || !cart_load(run->gb, (char *)run->rom)) {
+        return NULL;
+    }
+
+    cpu_set_dispatch(run->gb, DISPATCH_BLOCKS);
+
+    for (int i = 0; i < run->steps; i++) {
+        cpu_step(run->gb);
+    }
+
+    cpu_get_f(&run->gb->cpu);
+    return NULL;
+}
+
+// Two instances running at the same time end up exactly where each one
+// ends up running alone
+START_TEST(test_instances) {
+    instance_run runs[2] = {
+        {ROM_DIR "/06-ld r,r.gb", 200000},
+        {ROM_DIR "/09-op r,r.gb", 200000},
+    };
+    instance_run alone[2] = {runs[0], runs[1]};
+    pthread_t threads[2];
+
+    for (int i = 0; i < 2; i++) {
+        ck_assert(!pthread_create(&threads[i], NULL, run_instance, &runs[i]));
+    }
+
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        run_instance(&alone[i]);
+
+        ck_assert(runs[i].gb && alone[i].gb);
+        ck_assert(runs[i].gb->emu.ticks == alone[i].gb->emu.ticks);
+        ck_assert(!memcmp(&runs[i].gb->cpu.regs, &alone[i].gb->cpu.regs, sizeof(cpu_registers)));
+        ck_assert(!memcmp(runs[i].gb->ram.wram, alone[i].gb->ram.wram, sizeof(runs[i].gb->ram.wram)));
+
+        gb_destroy(runs[i].gb);
+        gb_destroy(alone[i].gb);
+    }
 } END_TEST
 
 Suite *stack_suite() {
     Suite *s = suite_create("emu");
     TCase *tc = tcase_create("core");
 
+    // ROM tests run millions of instructions, and the AOT test runs a compiler
+    tcase_set_timeout(tc, 60);
+    tcase_add_checked_fixture(tc, gb_setup, gb_teardown);
+
     tcase_add_test(tc, test_nothing);
+    tcase_add_test(tc, test_alu_tables);
+    tcase_add_test(tc, test_register_pairs);
+    tcase_add_test(tc, test_dispatch_differential);
+    tcase_add_test(tc, test_block_cache_matches_table);
+    tcase_add_test(tc, test_fused_matches_table);
+    tcase_add_test(tc, test_page_table);
+    tcase_add_test(tc, test_io_table);
+    tcase_add_test(tc, test_timer_skip);
+    tcase_add_test(tc, test_mbc_banking);
+    tcase_add_test(tc, test_rom_image);
+    tcase_add_test(tc, test_battery_save);
+    tcase_add_test(tc, test_mbc3_rtc);
+    tcase_add_test(tc, test_timer_reads);
+    tcase_add_test(tc, test_halt_skip);
+    tcase_add_test(tc, test_interrupt_dispatch);
+    tcase_add_test(tc, test_idle_matches_table);
+#ifdef GBEMU_JIT
+    tcase_add_test(tc, test_jit_matches_table);
+#endif
+    tcase_add_test(tc, test_aot_matches_table);
+    tcase_add_test(tc, test_aot_region_straddle);
+    tcase_add_test(tc, test_instances);
     suite_add_tcase(s, tc);
 
     return s;